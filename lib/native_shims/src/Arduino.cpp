@@ -0,0 +1,178 @@
+#include "Arduino.h"
+#include <time.h>
+#include <unistd.h>
+
+EspClass ESP;
+HardwareSerial Serial;
+
+static uint64_t nowMicros()
+{
+  static uint64_t started = 0;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  if (started == 0)
+  {
+    started = now;
+  }
+  return now - started;
+}
+
+unsigned long millis()
+{
+  return nowMicros() / 1000;
+}
+
+unsigned long micros()
+{
+  return nowMicros();
+}
+
+void delay(unsigned long ms)
+{
+  unsigned long start = millis();
+  while (millis() - start < ms)
+  {
+    usleep(1000);
+  }
+}
+
+void yield()
+{
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t, uint8_t)
+{
+}
+
+long random(long howBig)
+{
+  return howBig <= 0 ? 0 : rand() % howBig;
+}
+
+long random(long howSmall, long howBig)
+{
+  return howSmall >= howBig ? howSmall : howSmall + random(howBig - howSmall);
+}
+
+void randomSeed(unsigned long seed)
+{
+  srand(seed);
+}
+
+char *dtostrf(double value, signed char width, unsigned char precision, char *buffer)
+{
+  sprintf(buffer, "%*.*f", width, precision, value);
+  return buffer;
+}
+
+static char *formatNumber(unsigned long value, bool negative, char *buffer, int radix)
+{
+  char digits[66];
+  char *p = digits + sizeof(digits) - 1;
+  *p = 0;
+  do
+  {
+    int digit = value % radix;
+    *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= radix;
+  } while (value > 0);
+  if (negative)
+  {
+    *--p = '-';
+  }
+  return strcpy(buffer, p);
+}
+
+char *itoa(int value, char *buffer, int radix)
+{
+  return ltoa(value, buffer, radix);
+}
+
+char *ltoa(long value, char *buffer, int radix)
+{
+  if (radix == 10 && value < 0)
+  {
+    return formatNumber(-(unsigned long)value, true, buffer, radix);
+  }
+  return formatNumber((unsigned long)value, false, buffer, radix);
+}
+
+char *utoa(unsigned int value, char *buffer, int radix)
+{
+  return formatNumber(value, false, buffer, radix);
+}
+
+char *ultoa(unsigned long value, char *buffer, int radix)
+{
+  return formatNumber(value, false, buffer, radix);
+}
+
+uint32_t EspClass::getChipId()
+{
+  return 0x00C75602;
+}
+
+// The host has no heap limit worth reporting, these are typical ESP8266 figures
+uint32_t EspClass::getFreeHeap()
+{
+  return 40000;
+}
+
+uint8_t EspClass::getHeapFragmentation()
+{
+  return 0;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize()
+{
+  return 40000;
+}
+
+void EspClass::restart()
+{
+  printf("ESP.restart()\n");
+  exit(0);
+}
+
+// RTC memory is gone with the process, every run is a power on
+static uint32_t rtcUserMemory[128];
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size)
+{
+  if (offset * 4 + size > sizeof(rtcUserMemory))
+  {
+    return false;
+  }
+  memcpy(data, (uint8_t *)rtcUserMemory + offset * 4, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size)
+{
+  if (offset * 4 + size > sizeof(rtcUserMemory))
+  {
+    return false;
+  }
+  memcpy((uint8_t *)rtcUserMemory + offset * 4, data, size);
+  return true;
+}
+
+void EspClass::reset()
+{
+  printf("ESP.reset()\n");
+  exit(1);
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  if (peer != NULL)
+  {
+    peer->receive(c);
+  }
+  return 1;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "Arduino.h"
+
+// No over the air updates on the host
+class ArduinoOTAClass
+{
+public:
+  void setHostname(const char *) {}
+  void begin() {}
+  void handle() {}
+};
+
+extern ArduinoOTAClass ArduinoOTA;
@@ -0,0 +1,74 @@
+/*
+ *  Host shim of the ESP8266 WiFi classes on top of BSD sockets. Servers on ports below 1024
+ *  listen on port + 8000 instead, so the gateway runs without root (HTTP on 8080).
+ */
+#pragma once
+#include "Arduino.h"
+#include "Client.h"
+#include "IPAddress.h"
+
+#define WL_CONNECTED 3
+#define WIFI_STA 1
+
+class WiFiClient : public Client
+{
+public:
+  WiFiClient() : socket(-1), peeked(-1) {}
+  explicit WiFiClient(int socket) : socket(socket), peeked(-1) {}
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char *host, uint16_t port) override;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int available() override;
+  int availableForWrite() override; // Free room in the socket send buffer
+  int read() override;
+  int read(uint8_t *buffer, size_t size) override;
+  int peek() override;
+  uint8_t connected() override;
+  void stop() override;
+  operator bool() override { return socket >= 0; }
+  void setNoDelay(bool) {}
+  using Print::write;
+
+private:
+  int socket;
+  int peeked;
+};
+
+class WiFiServer
+{
+public:
+  WiFiServer(uint16_t port) : port(port), socket(-1) {}
+  void begin();
+  WiFiClient available();
+
+private:
+  uint16_t port;
+  int socket;
+};
+
+class ESP8266WiFiClass
+{
+public:
+  void mode(int) {}
+  void hostname(const char *) {}
+  void persistent(bool) {}
+  void begin(const char *, const char *, int32_t = 0, const uint8_t * = NULL) {}
+  bool config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress()) { return true; }
+  int waitForConnectResult() { return WL_CONNECTED; }
+  int status() { return WL_CONNECTED; }
+  void setAutoReconnect(bool) {}
+  bool disconnect(bool = false) { return true; }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress gatewayIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress subnetMask() { return IPAddress(255, 0, 0, 0); }
+  IPAddress dnsIP(uint8_t = 0) { return IPAddress(127, 0, 0, 1); }
+  uint8_t *BSSID() { return bssid; }
+  int32_t channel() { return 1; }
+
+private:
+  uint8_t bssid[6] = {0x02, 0, 0, 0, 0, 1};
+};
+
+extern ESP8266WiFiClass WiFi;
@@ -0,0 +1,35 @@
+#pragma once
+#include "Stream.h"
+
+#define SERIAL_8E1 0x1e
+
+// Whatever is at the other end of the line. The CTS602 simulator implements this
+class SerialPeer
+{
+public:
+  virtual ~SerialPeer() {}
+  virtual void receive(uint8_t c) = 0; // Byte written by the gateway
+  virtual int available() = 0;         // Bytes ready for the gateway to read
+  virtual int read() = 0;
+};
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud, uint8_t config = SERIAL_8E1) { (void)config; this->baud = baud; }
+  void end() {}
+  void attach(SerialPeer *peer) { this->peer = peer; }
+
+  int available() override { return peer != NULL ? peer->available() : 0; }
+  int read() override { return peer != NULL && peer->available() > 0 ? peer->read() : -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  unsigned long baud = 19200;
+
+private:
+  SerialPeer *peer = NULL;
+};
+
+extern HardwareSerial Serial;
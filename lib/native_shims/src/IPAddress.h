@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+
+class IPAddress
+{
+public:
+  IPAddress() : address{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address{a, b, c, d} {}
+  // First octet in the low byte, as on the ESP8266
+  IPAddress(uint32_t value) : address{(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)} {}
+  operator uint32_t() const { return address[0] | address[1] << 8 | address[2] << 16 | (uint32_t)address[3] << 24; }
+  uint8_t operator[](int index) const { return address[index]; }
+  uint8_t &operator[](int index) { return address[index]; }
+  bool operator==(const IPAddress &other) const
+  {
+    return address[0] == other.address[0] && address[1] == other.address[1] && address[2] == other.address[2] && address[3] == other.address[3];
+  }
+
+private:
+  uint8_t address[4];
+};
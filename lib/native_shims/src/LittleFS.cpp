@@ -0,0 +1,88 @@
+#include "LittleFS.h"
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FS LittleFS;
+
+static std::string hostPath(const char *path)
+{
+  const char *root = getenv("NATIVE_FS");
+  return std::string(root != NULL ? root : "native_fs") + path;
+}
+
+int File::available()
+{
+  if (file == NULL)
+  {
+    return 0;
+  }
+  long position = ftell(file);
+  fseek(file, 0, SEEK_END);
+  long end = ftell(file);
+  fseek(file, position, SEEK_SET);
+  return end - position;
+}
+
+int File::peek()
+{
+  if (file == NULL)
+  {
+    return -1;
+  }
+  int c = fgetc(file);
+  if (c >= 0)
+  {
+    ungetc(c, file);
+  }
+  return c;
+}
+
+size_t File::size()
+{
+  if (file == NULL)
+  {
+    return 0;
+  }
+  long position = ftell(file);
+  fseek(file, 0, SEEK_END);
+  long end = ftell(file);
+  fseek(file, position, SEEK_SET);
+  return end;
+}
+
+void File::close()
+{
+  if (file != NULL)
+  {
+    fclose(file);
+    file = NULL;
+  }
+}
+
+bool FS::begin()
+{
+  std::string root = hostPath("");
+  mkdir(root.c_str(), 0755);
+  return true;
+}
+
+File FS::open(const char *path, const char *mode)
+{
+  return File(fopen(hostPath(path).c_str(), mode));
+}
+
+bool FS::exists(const char *path)
+{
+  return access(hostPath(path).c_str(), F_OK) == 0;
+}
+
+bool FS::remove(const char *path)
+{
+  return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to)
+{
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
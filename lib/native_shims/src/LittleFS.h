@@ -0,0 +1,39 @@
+/*
+ *  Host shim of LittleFS. Files live below the directory in $NATIVE_FS, or ./native_fs when not set.
+ */
+#pragma once
+#include "Arduino.h"
+
+class File : public Stream
+{
+public:
+  File() : file(NULL) {}
+  explicit File(FILE *file) : file(file) {}
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override { return file != NULL ? fwrite(buffer, 1, size, file) : 0; }
+  int available() override;
+  int read() override { return file != NULL ? fgetc(file) : -1; }
+  int read(uint8_t *buffer, size_t size) { return file != NULL ? (int)fread(buffer, 1, size, file) : -1; }
+  int peek() override;
+  size_t size();
+  bool seek(uint32_t position) { return file != NULL && fseek(file, position, SEEK_SET) == 0; }
+  void close();
+  operator bool() const { return file != NULL; }
+  using Print::write;
+
+private:
+  FILE *file;
+};
+
+class FS
+{
+public:
+  bool begin();
+  File open(const char *path, const char *mode);
+  bool exists(const char *path);
+  bool remove(const char *path);
+  bool rename(const char *from, const char *to);
+};
+
+extern FS LittleFS;
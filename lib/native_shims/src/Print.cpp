@@ -0,0 +1,95 @@
+#include "Print.h"
+#include <stdio.h>
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+  {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::print(const __FlashStringHelper *text)
+{
+  return write((const char *)text);
+}
+
+size_t Print::print(const char *text)
+{
+  return write(text);
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+static size_t printNumber(Print &out, unsigned long long value, int base, bool negative)
+{
+  char buffer[68];
+  char *p = buffer + sizeof(buffer) - 1;
+  *p = 0;
+  if (base < 2)
+  {
+    base = 10;
+  }
+  do
+  {
+    int digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value > 0);
+  if (negative)
+  {
+    *--p = '-';
+  }
+  return out.write(p);
+}
+
+size_t Print::print(int value, int base)
+{
+  return print((long long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base)
+{
+  return printNumber(*this, value, base, false);
+}
+
+size_t Print::print(long value, int base)
+{
+  return print((long long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+  return printNumber(*this, value, base, false);
+}
+
+size_t Print::print(long long value, int base)
+{
+  if (base == 10 && value < 0)
+  {
+    return printNumber(*this, -(unsigned long long)value, base, true);
+  }
+  return printNumber(*this, (unsigned long long)value, base, false);
+}
+
+size_t Print::print(unsigned long long value, int base)
+{
+  return printNumber(*this, value, base, false);
+}
+
+size_t Print::print(double value, int digits)
+{
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  return write(buffer);
+}
+
+size_t Print::println()
+{
+  return write("\r\n");
+}
@@ -0,0 +1,177 @@
+#include "ESP8266WiFi.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+ESP8266WiFiClass WiFi;
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+  char host[16];
+  sprintf(host, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return connect(host, port);
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+  stop();
+  struct addrinfo hints = {};
+  struct addrinfo *result = NULL;
+  char service[6];
+  sprintf(service, "%u", port);
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, service, &hints, &result) != 0)
+  {
+    return 0;
+  }
+  socket = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (socket >= 0 && ::connect(socket, result->ai_addr, result->ai_addrlen) != 0)
+  {
+    close(socket);
+    socket = -1;
+  }
+  freeaddrinfo(result);
+  if (socket < 0)
+  {
+    return 0;
+  }
+  int one = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return 1;
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+  if (socket < 0)
+  {
+    return 0;
+  }
+  ssize_t n = send(socket, buffer, size, MSG_NOSIGNAL);
+  return n < 0 ? 0 : n;
+}
+
+int WiFiClient::available()
+{
+  if (socket < 0)
+  {
+    return 0;
+  }
+  int count = 0;
+  ioctl(socket, FIONREAD, &count);
+  return count + (peeked >= 0 ? 1 : 0);
+}
+
+int WiFiClient::availableForWrite()
+{
+  if (socket < 0)
+  {
+    return 0;
+  }
+  int size = 0;
+  int queued = 0;
+  socklen_t length = sizeof(size);
+  getsockopt(socket, SOL_SOCKET, SO_SNDBUF, &size, &length);
+  ioctl(socket, TIOCOUTQ, &queued);
+  return size > queued ? size - queued : 0;
+}
+
+int WiFiClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buffer, size_t size)
+{
+  if (size == 0 || socket < 0)
+  {
+    return 0;
+  }
+  size_t n = 0;
+  if (peeked >= 0)
+  {
+    buffer[n++] = peeked;
+    peeked = -1;
+  }
+  if (n < size && available() > 0)
+  {
+    ssize_t r = recv(socket, buffer + n, size - n, MSG_DONTWAIT);
+    if (r > 0)
+    {
+      n += r;
+    }
+  }
+  return n;
+}
+
+int WiFiClient::peek()
+{
+  if (peeked < 0)
+  {
+    peeked = read();
+  }
+  return peeked;
+}
+
+uint8_t WiFiClient::connected()
+{
+  if (socket < 0)
+  {
+    return 0;
+  }
+  if (available() > 0)
+  {
+    return 1;
+  }
+  uint8_t c;
+  ssize_t r = recv(socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return r != 0 && !(r < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+void WiFiClient::stop()
+{
+  if (socket >= 0)
+  {
+    close(socket);
+    socket = -1;
+  }
+  peeked = -1;
+}
+
+void WiFiServer::begin()
+{
+  uint16_t hostPort = port < 1024 ? port + 8000 : port;
+  socket = ::socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(hostPort);
+  if (bind(socket, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(socket, 8) != 0)
+  {
+    printf("Could not listen on port %u\n", hostPort);
+    close(socket);
+    socket = -1;
+    return;
+  }
+  fcntl(socket, F_SETFL, O_NONBLOCK);
+  printf("Listening on port %u\n", hostPort);
+}
+
+WiFiClient WiFiServer::available()
+{
+  if (socket < 0)
+  {
+    return WiFiClient();
+  }
+  int client = accept(socket, NULL, NULL);
+  return client < 0 ? WiFiClient() : WiFiClient(client);
+}
@@ -0,0 +1,96 @@
+#include "aggregate.h"
+#include "register_map.h"
+
+static int16_t aggregateMins[AGGREGATE_SLOTS];
+static int16_t aggregateMaxs[AGGREGATE_SLOTS];
+static int32_t aggregateSums[AGGREGATE_SLOTS];
+static uint8_t aggregateFirst[reqmax]; // First slot of each aggregated group
+static uint16_t aggregateCounts[reqmax];
+static uint64_t aggregateStarts[reqmax];
+static uint32_t aggregateGroups = 0;
+
+uint32_t aggregateBegin(uint32_t groups)
+{
+  uint8_t used = 0;
+  aggregateGroups = 0;
+  for (int g = 0; g < reqmax; g++)
+  {
+    uint8_t count = getGroup(g).count;
+    if (!(groups & (1UL << g)) || count == 0 || used + count > AGGREGATE_SLOTS)
+    {
+      continue;
+    }
+    aggregateFirst[g] = used;
+    aggregateCounts[g] = 0;
+    used += count;
+    aggregateGroups |= 1UL << g;
+  }
+  return aggregateGroups;
+}
+
+bool aggregateGroup(int group)
+{
+  return aggregateGroups & (1UL << group);
+}
+
+void aggregateAdd(int group, const int16_t *values, uint64_t now)
+{
+  if (!aggregateGroup(group) || aggregateCounts[group] == 0xFFFF)
+  {
+    return; // Not aggregated, or the interval is far too long for the sample period
+  }
+  uint8_t first = aggregateFirst[group];
+  uint8_t count = getGroup(group).count;
+  if (aggregateCounts[group] == 0)
+  {
+    aggregateStarts[group] = now;
+    memcpy(aggregateMins + first, values, count * sizeof(int16_t));
+    memcpy(aggregateMaxs + first, values, count * sizeof(int16_t));
+    memset(aggregateSums + first, 0, count * sizeof(int32_t));
+  }
+  for (uint8_t i = 0; i < count; i++)
+  {
+    int16_t value = values[i];
+    if (value < aggregateMins[first + i])
+    {
+      aggregateMins[first + i] = value;
+    }
+    if (value > aggregateMaxs[first + i])
+    {
+      aggregateMaxs[first + i] = value;
+    }
+    aggregateSums[first + i] += value;
+  }
+  aggregateCounts[group]++;
+}
+
+void aggregateReset(int group)
+{
+  aggregateCounts[group] = 0;
+}
+
+uint16_t aggregateCount(int group)
+{
+  return aggregateGroup(group) ? aggregateCounts[group] : 0;
+}
+
+uint64_t aggregateStart(int group)
+{
+  return aggregateStarts[group];
+}
+
+const int16_t *aggregateMin(int group)
+{
+  return aggregateMins + aggregateFirst[group];
+}
+
+const int16_t *aggregateMax(int group)
+{
+  return aggregateMaxs + aggregateFirst[group];
+}
+
+float aggregateMean(int group, uint8_t offset)
+{
+  uint16_t count = aggregateCounts[group];
+  return count ? (float)aggregateSums[aggregateFirst[group] + offset] / count : 0;
+}
@@ -0,0 +1,20 @@
+/*
+ *  Aggregates of fast sampled groups.
+ *  Some groups are read every few seconds but published once per reporting interval as min, max and mean
+ *  of the samples, so short events like a defrost cycle or a temperature dip show up without publishing
+ *  every reading. The accumulators are a fixed pool of AGGREGATE_SLOTS registers, laid out like a group read.
+ */
+#pragma once
+#include <Arduino.h>
+
+#define AGGREGATE_SLOTS 32 // Registers with accumulators, shared by all aggregated groups
+
+uint32_t aggregateBegin(uint32_t groups); // Returns the groups that got accumulators, the rest didn't fit
+bool aggregateGroup(int group);           // The group is aggregated
+void aggregateAdd(int group, const int16_t *values, uint64_t now); // group.count values as read from the bus, now is clockMillis()
+void aggregateReset(int group);           // Starts the next interval
+uint16_t aggregateCount(int group);       // Samples of the running interval
+uint64_t aggregateStart(int group);       // clockMillis() of the first sample of the running interval
+const int16_t *aggregateMin(int group);   // group.count values like a read, valid while the count is not 0
+const int16_t *aggregateMax(int group);
+float aggregateMean(int group, uint8_t offset); // In register units
@@ -0,0 +1,208 @@
+#include "alarm_decoder.h"
+
+// Alarm codes of the CTS602 and their text. Codes not listed are unknown
+#define NILAN_ALARMS \
+  NILAN_ALARM(0, "NONE") \
+  NILAN_ALARM(1, "HARDWARE") \
+  NILAN_ALARM(2, "TIMEOUT") \
+  NILAN_ALARM(3, "FIRE") \
+  NILAN_ALARM(4, "PRESSURE") \
+  NILAN_ALARM(5, "DOOR") \
+  NILAN_ALARM(6, "DEFROST") \
+  NILAN_ALARM(7, "FROST") \
+  NILAN_ALARM(8, "FROST") \
+  NILAN_ALARM(9, "OVERTEMP") \
+  NILAN_ALARM(10, "OVERHEAT") \
+  NILAN_ALARM(11, "AIRFLOW") \
+  NILAN_ALARM(12, "THERMO") \
+  NILAN_ALARM(13, "BOILING") \
+  NILAN_ALARM(14, "SENSOR") \
+  NILAN_ALARM(15, "ROOM LOW") \
+  NILAN_ALARM(16, "SOFTWARE") \
+  NILAN_ALARM(17, "WATCHDOG") \
+  NILAN_ALARM(18, "CONFIG") \
+  NILAN_ALARM(19, "FILTER") \
+  NILAN_ALARM(20, "LEGIONEL") \
+  NILAN_ALARM(21, "POWER") \
+  NILAN_ALARM(22, "T AIR") \
+  NILAN_ALARM(23, "T WATER") \
+  NILAN_ALARM(24, "T HEAT") \
+  NILAN_ALARM(25, "MODEM") \
+  NILAN_ALARM(26, "INSTABUS") \
+  NILAN_ALARM(27, "T1SHORT") \
+  NILAN_ALARM(28, "T1OPEN") \
+  NILAN_ALARM(29, "T2SHORT") \
+  NILAN_ALARM(30, "T2OPEN") \
+  NILAN_ALARM(31, "T3SHORT") \
+  NILAN_ALARM(32, "T3OPEN") \
+  NILAN_ALARM(33, "T4SHORT") \
+  NILAN_ALARM(34, "T4OPEN") \
+  NILAN_ALARM(35, "T5SHORT") \
+  NILAN_ALARM(36, "T5OPEN") \
+  NILAN_ALARM(37, "T6SHORT") \
+  NILAN_ALARM(38, "T6OPEN") \
+  NILAN_ALARM(39, "T7SHORT") \
+  NILAN_ALARM(40, "T7OPEN") \
+  NILAN_ALARM(41, "T8SHORT") \
+  NILAN_ALARM(42, "T8OPEN") \
+  NILAN_ALARM(43, "T9SHORT") \
+  NILAN_ALARM(44, "T9OPEN") \
+  NILAN_ALARM(45, "T10SHORT") \
+  NILAN_ALARM(46, "T10OPEN") \
+  NILAN_ALARM(47, "T11SHORT") \
+  NILAN_ALARM(48, "T11OPEN") \
+  NILAN_ALARM(49, "T12SHORT") \
+  NILAN_ALARM(50, "T12OPEN") \
+  NILAN_ALARM(51, "T13SHORT") \
+  NILAN_ALARM(52, "T13OPEN") \
+  NILAN_ALARM(53, "T14SHORT") \
+  NILAN_ALARM(54, "T14OPEN") \
+  NILAN_ALARM(55, "T15SHORT") \
+  NILAN_ALARM(56, "T15OPEN") \
+  NILAN_ALARM(57, "T16SHORT") \
+  NILAN_ALARM(58, "T16OPEN") \
+  NILAN_ALARM(70, "ANODE") \
+  NILAN_ALARM(71, "EXCH INFO") \
+  NILAN_ALARM(90, "SLAVE IO") \
+  NILAN_ALARM(91, "OPT IO") \
+  NILAN_ALARM(92, "PRESET")
+
+#define ALARM_CODE_COUNT 93 // Highest code + 1
+
+#define NILAN_ALARM(code, text) static const char alarmText_##code[] PROGMEM = text;
+NILAN_ALARMS
+#undef NILAN_ALARM
+
+// Text pointer per code, gaps stay NULL. A code outside the table fails to compile
+struct AlarmTable
+{
+  const char *text[ALARM_CODE_COUNT];
+  constexpr AlarmTable() : text()
+  {
+#define NILAN_ALARM(code, name) text[code] = alarmText_##code;
+    NILAN_ALARMS
+#undef NILAN_ALARM
+  }
+};
+
+static constexpr AlarmTable alarmTable PROGMEM;
+
+static AlarmEvent history[ALARM_HISTORY_SIZE];
+static uint8_t historyHead = 0; // Next position to write
+static uint8_t historyCount = 0;
+
+static_assert(ALARM_HISTORY_SIZE >= ALARM_SLOTS, "The history must hold the whole alarm list");
+
+const char *alarmText(uint16_t code)
+{
+  if (code >= ALARM_CODE_COUNT)
+  {
+    return NULL;
+  }
+  return (const char *)pgm_read_ptr(&alarmTable.text[code]);
+}
+
+// Date: bits 15-9 year since 1980, 8-5 month, 4-0 day
+DosDate decodeDosDate(uint16_t value)
+{
+  DosDate date;
+  date.year = 1980 + (value >> 9);
+  date.month = (value >> 5) & 0x0F;
+  date.day = value & 0x1F;
+  return date;
+}
+
+// Time: bits 15-11 hour, 10-5 minute, 4-0 seconds / 2
+DosTime decodeDosTime(uint16_t value)
+{
+  DosTime time;
+  time.hour = value >> 11;
+  time.minute = (value >> 5) & 0x3F;
+  time.second = (value & 0x1F) * 2;
+  return time;
+}
+
+void formatAlarmCode(uint16_t code, char *text)
+{
+  if (code == 0)
+  {
+    strcpy(text, "None"); // No alarm
+    return;
+  }
+  const char *name = alarmText(code);
+  if (name == NULL)
+  {
+    strcpy(text, "UNKNOWN");
+    return;
+  }
+  strcpy_P(text, name);
+}
+
+void formatDosDate(uint16_t value, char *text)
+{
+  if (value == 0)
+  {
+    strcpy(text, "N/A"); // No alarm
+    return;
+  }
+  DosDate date = decodeDosDate(value);
+  sprintf(text, "%04u-%02u-%02u", date.year, date.month, date.day);
+}
+
+void formatDosTime(uint16_t value, char *text)
+{
+  if (value == 0)
+  {
+    strcpy(text, "N/A"); // No alarm
+    return;
+  }
+  DosTime time = decodeDosTime(value);
+  sprintf(text, "%02u:%02u:%02u", time.hour, time.minute, time.second);
+}
+
+static bool inHistory(const AlarmEvent &event)
+{
+  for (uint8_t i = 0; i < historyCount; i++)
+  {
+    const AlarmEvent &known = history[(historyHead + ALARM_HISTORY_SIZE - 1 - i) % ALARM_HISTORY_SIZE];
+    if (known.code == event.code && known.date == event.date && known.time == event.time)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t alarmUpdate(const int16_t *list, AlarmEvent *events)
+{
+  uint8_t n = 0;
+  for (uint8_t slot = 0; slot < ALARM_SLOTS; slot++)
+  {
+    AlarmEvent event;
+    event.code = list[slot * 3];
+    event.date = list[slot * 3 + 1];
+    event.time = list[slot * 3 + 2];
+    if (event.code == 0 || inHistory(event))
+    {
+      continue;
+    }
+    history[historyHead] = event;
+    historyHead = (historyHead + 1) % ALARM_HISTORY_SIZE;
+    if (historyCount < ALARM_HISTORY_SIZE)
+    {
+      historyCount++;
+    }
+    events[n++] = event;
+  }
+  return n;
+}
+
+uint8_t alarmHistoryCount()
+{
+  return historyCount;
+}
+
+AlarmEvent alarmHistory(uint8_t index)
+{
+  return history[(historyHead + ALARM_HISTORY_SIZE - 1 - index) % ALARM_HISTORY_SIZE];
+}
@@ -0,0 +1,47 @@
+/*
+ *  Alarm list decoding of the CTS602.
+ *  The controller keeps its last alarms in 3 slots of ID, date and time (input registers 401-409).
+ *  Codes are looked up in a direct indexed flash table, dates and times are packed like DOS timestamps.
+ *  New entries of the list are kept in a small ring buffer so each alarm is reported once.
+ */
+#pragma once
+#include <Arduino.h>
+
+#define ALARM_SLOTS 3        // Entries in the alarm list of the controller
+#define ALARM_HISTORY_SIZE 8 // Alarm events remembered by the gateway, must be at least ALARM_SLOTS
+
+struct DosDate
+{
+  uint16_t year;
+  uint8_t month;
+  uint8_t day;
+};
+
+struct DosTime
+{
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+};
+
+struct AlarmEvent
+{
+  uint16_t code;
+  uint16_t date; // DOS packed
+  uint16_t time; // DOS packed
+};
+
+const char *alarmText(uint16_t code); // In flash, NULL for an unknown code
+DosDate decodeDosDate(uint16_t value);
+DosTime decodeDosTime(uint16_t value);
+
+// Text as published, "None"/"N/A" when the slot is empty. text must hold 12 characters
+void formatAlarmCode(uint16_t code, char *text);
+void formatDosDate(uint16_t value, char *text);
+void formatDosTime(uint16_t value, char *text);
+
+// list: the ALARM_SLOTS * 3 registers following the alarm status register
+// Adds the entries not seen before to the history and copies them to events. Returns their number
+uint8_t alarmUpdate(const int16_t *list, AlarmEvent *events);
+uint8_t alarmHistoryCount();
+AlarmEvent alarmHistory(uint8_t index); // 0 is the newest event
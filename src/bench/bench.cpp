@@ -0,0 +1,256 @@
+/*
+ *  Microbenchmarks of the value encoding and publish formatting, run over every register group.
+ *  Built instead of the gateway by the native_bench and nodemcuv2_bench environments. Writes one JSON
+ *  object per line, to stdout on the host and to the serial port on the ESP, so results can be diffed
+ *  between releases.
+ *
+ *  Allocations are counted by wrapping malloc, calloc and realloc at link time (-Wl,--wrap).
+ */
+#ifdef NILAN_BENCH
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "../register_map.h"
+#include "../value_format.h"
+#include "../alarm_decoder.h"
+#include "../buffered_print.h"
+
+#ifdef NILAN_NATIVE
+#define BENCH_ITERATIONS 100000
+#else
+#define BENCH_ITERATIONS 1000
+#endif
+
+static uint32_t benchAllocs = 0;
+static uint32_t benchAllocBytes = 0;
+static volatile uint32_t benchSink = 0; // Keeps the compiler from dropping the work
+
+extern "C"
+{
+  void *__real_malloc(size_t size);
+  void *__real_calloc(size_t count, size_t size);
+  void *__real_realloc(void *ptr, size_t size);
+
+  void *__wrap_malloc(size_t size)
+  {
+    benchAllocs++;
+    benchAllocBytes += size;
+    return __real_malloc(size);
+  }
+
+  void *__wrap_calloc(size_t count, size_t size)
+  {
+    benchAllocs++;
+    benchAllocBytes += count * size;
+    return __real_calloc(count, size);
+  }
+
+  void *__wrap_realloc(void *ptr, size_t size)
+  {
+    benchAllocs++;
+    benchAllocBytes += size;
+    return __real_realloc(ptr, size);
+  }
+}
+
+typedef void (*BenchFunction)(int group, const int16_t *values);
+
+// Plausible value of every register of a group, by format
+static void sampleValues(int r, int16_t *values)
+{
+  GroupDesc group = getGroup(r);
+  memset(values, 0, MAX_REG_SIZE * sizeof(int16_t));
+  for (int i = 0; i < group.registerCount; i++)
+  {
+    RegisterDesc reg = getRegister(group.firstRegister + i);
+    int16_t value = 3;
+    switch (reg.format)
+    {
+    case FORMAT_TEMP:
+      value = 2154;
+      break;
+    case FORMAT_HUMIDITY:
+      value = 4530;
+      break;
+    case FORMAT_SCALED:
+      value = 1234;
+      break;
+    case FORMAT_ASCII:
+      value = (' ' << 8) | '2';
+      break;
+    case FORMAT_ALARM_CODE:
+      value = 19;
+      break;
+    case FORMAT_DOS_DATE:
+      value = (44 << 9) | (3 << 5) | 17;
+      break;
+    case FORMAT_DOS_TIME:
+      value = (13 << 11) | (45 << 5) | 29;
+      break;
+    }
+    values[reg.offset] = value;
+  }
+}
+
+// MQTT text of every register, dtostrf for the scaled values and the alarm list sprintf chains
+static void benchFormat(int r, const int16_t *values)
+{
+  GroupDesc group = getGroup(r);
+  for (int i = 0; i < group.registerCount; i++)
+  {
+    RegisterDesc reg = getRegister(group.firstRegister + i);
+    char numberString[12];
+    formatValue(reg, values[reg.offset], numberString);
+    benchSink += numberString[0];
+  }
+}
+
+// Topic of every register as built in the poll loop
+static void benchTopic(int r, const int16_t *)
+{
+  GroupDesc group = getGroup(r);
+  for (int i = 0; i < group.registerCount; i++)
+  {
+    RegisterDesc reg = getRegister(group.firstRegister + i);
+    benchSink += strlen(registerTopic(group.topic, reg));
+  }
+}
+
+// HTTP /read/<group> response, the document is allocated per request like in HandleRequest
+static void benchHttpJson(int r, const int16_t *values)
+{
+  DynamicJsonDocument doc(responseCapacity);
+  JsonObject root = doc.to<JsonObject>();
+  addRegisterValues(root, r, values);
+  root["operation"] = "read";
+  root["group"] = FPSTR(getGroup(r).name);
+  CountingPrint out;
+  serializeJson(doc, out);
+  benchSink += out.count();
+}
+
+static StaticJsonDocument<JSON_OBJECT_SIZE(MAX_REG_SIZE) + MAX_REG_SIZE * 24> batchDoc;
+
+// Batched MQTT payload of the group, as published with MQTT_PAYLOAD_JSON
+static void benchBatchJson(int r, const int16_t *values)
+{
+  addRegisterValues(batchDoc.to<JsonObject>(), r, values);
+  CountingPrint out;
+  benchSink += measureJson(batchDoc);
+  serializeJson(batchDoc, out);
+  benchSink += out.count();
+}
+
+// Batched MQTT payload of the group, as published with MQTT_PAYLOAD_MSGPACK
+static void benchBatchMsgPack(int r, const int16_t *values)
+{
+  addRegisterValues(batchDoc.to<JsonObject>(), r, values);
+  CountingPrint out;
+  benchSink += measureMsgPack(batchDoc);
+  serializeMsgPack(batchDoc, out);
+  benchSink += out.count();
+}
+
+struct Benchmark
+{
+  const char *name;
+  BenchFunction function;
+};
+
+static const Benchmark benchmarks[] = {
+    {"format", benchFormat},
+    {"topic", benchTopic},
+    {"httpJson", benchHttpJson},
+    {"batchJson", benchBatchJson},
+    {"batchMsgPack", benchBatchMsgPack},
+};
+
+static void runBenchmark(Print &out, const Benchmark &bench, int r)
+{
+  int16_t values[MAX_REG_SIZE];
+  sampleValues(r, values);
+  bench.function(r, values); // Warm up, first use of static documents and the like
+  benchAllocs = 0;
+  benchAllocBytes = 0;
+  unsigned long start = micros();
+  for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    bench.function(r, values);
+  }
+  unsigned long elapsed = micros() - start;
+  uint32_t allocs = benchAllocs;
+  uint32_t allocBytes = benchAllocBytes;
+  GroupDesc group = getGroup(r);
+  out.print(F("{\"bench\":\""));
+  out.print(bench.name);
+  out.print(F("\",\"group\":\""));
+  out.print(FPSTR(group.name));
+  out.print(F("\",\"registers\":"));
+  out.print(group.registerCount);
+  out.print(F(",\"iterations\":"));
+  out.print(BENCH_ITERATIONS);
+  out.print(F(",\"nsPerOp\":"));
+  out.print((uint32_t)((uint64_t)elapsed * 1000 / BENCH_ITERATIONS));
+  out.print(F(",\"allocsPerOp\":"));
+  out.print((double)allocs / BENCH_ITERATIONS, 2);
+  out.print(F(",\"bytesPerOp\":"));
+  out.print((double)allocBytes / BENCH_ITERATIONS, 1);
+  out.println('}');
+}
+
+static void runBenchmarks(Print &out)
+{
+  out.print(F("{\"platform\":\""));
+#ifdef NILAN_NATIVE
+  out.print(F("native"));
+#else
+  out.print(F("esp8266\",\"cpuMHz\":"));
+  out.print(ESP.getCpuFreqMHz());
+  out.print(F(",\"core\":\""));
+  out.print(ESP.getCoreVersion());
+#endif
+  out.print(F("\",\"compiled\":\"" __DATE__ " " __TIME__ "\"}\n"));
+  for (const Benchmark &bench : benchmarks)
+  {
+    for (int r = 0; r < reqmax; r++)
+    {
+      if (getGroup(r).registerCount == 0)
+      {
+        continue;
+      }
+      runBenchmark(out, bench, r);
+      yield();
+    }
+  }
+  out.println(F("{\"done\":true}"));
+}
+
+#ifdef NILAN_NATIVE
+class StdoutPrint : public Print
+{
+public:
+  size_t write(uint8_t c) override { return fwrite(&c, 1, 1, stdout); }
+  size_t write(const uint8_t *data, size_t size) override { return fwrite(data, 1, size, stdout); }
+  using Print::write;
+};
+
+int main()
+{
+  StdoutPrint out;
+  runBenchmarks(out);
+  return 0;
+}
+#else
+void setup()
+{
+  Serial.begin(115200);
+  delay(2000); // Time to open the monitor
+  runBenchmarks(Serial);
+}
+
+void loop()
+{
+  delay(1000);
+}
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+#include "buffered_print.h"
+
+size_t BufferedPrint::write(uint8_t c)
+{
+  if (length == BUFFERED_PRINT_SIZE)
+  {
+    flush();
+  }
+  buffer[length++] = c;
+  return 1;
+}
+
+size_t BufferedPrint::write(const uint8_t *data, size_t size)
+{
+  size_t written = size;
+  while (size > 0)
+  {
+    if (length == BUFFERED_PRINT_SIZE)
+    {
+      flush();
+    }
+    size_t n = BUFFERED_PRINT_SIZE - length;
+    if (n > size)
+    {
+      n = size;
+    }
+    memcpy(buffer + length, data, n);
+    length += n;
+    data += n;
+    size -= n;
+  }
+  return written;
+}
+
+void BufferedPrint::flush()
+{
+  if (length > 0)
+  {
+    target.write(buffer, length);
+    length = 0;
+  }
+}
+
+bool HeapPrint::reserve(size_t size)
+{
+  if (size <= capacity)
+  {
+    return true;
+  }
+  uint8_t *grown = (uint8_t *)realloc(data, size);
+  if (grown == NULL)
+  {
+    failure = true;
+    return false;
+  }
+  data = grown;
+  capacity = size;
+  return true;
+}
+
+size_t HeapPrint::write(const uint8_t *source, size_t size)
+{
+  // Grow by half at least, a body printed a few bytes at a time doesn't realloc for every write
+  if (length + size > capacity && !reserve(length + size > capacity * 3 / 2 ? length + size : capacity * 3 / 2))
+  {
+    return 0;
+  }
+  memcpy(data + length, source, size);
+  length += size;
+  return size;
+}
+
+uint8_t *HeapPrint::release()
+{
+  uint8_t *buffer = data;
+  data = NULL;
+  length = 0;
+  capacity = 0;
+  return buffer;
+}
@@ -0,0 +1,73 @@
+/*
+ *  Print that collects small writes in a fixed buffer and hands them to the target in larger blocks.
+ *  ArduinoJson writes one token at a time, without a buffer every token would end up in its own TCP packet.
+ *  CountingPrint only counts what is written to it, to learn the length of a response before sending it.
+ *  HeapPrint keeps everything written to it in a buffer on the heap, for output that is sent later.
+ */
+#pragma once
+#include <Arduino.h>
+
+#define BUFFERED_PRINT_SIZE 256
+
+class BufferedPrint : public Print
+{
+public:
+  BufferedPrint(Print &target) : target(target), length(0) {}
+  ~BufferedPrint() { flush(); }
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *data, size_t size) override;
+  void flush() override;
+
+  using Print::write;
+
+private:
+  Print &target;
+  uint8_t buffer[BUFFERED_PRINT_SIZE];
+  size_t length;
+};
+
+class CountingPrint : public Print
+{
+public:
+  CountingPrint() : written(0) {}
+
+  size_t write(uint8_t) override
+  {
+    written++;
+    return 1;
+  }
+  size_t write(const uint8_t *, size_t size) override
+  {
+    written += size;
+    return size;
+  }
+  size_t count() const { return written; }
+
+  using Print::write;
+
+private:
+  size_t written;
+};
+
+class HeapPrint : public Print
+{
+public:
+  HeapPrint() : data(NULL), length(0), capacity(0), failure(false) {}
+  ~HeapPrint() { free(data); }
+
+  bool reserve(size_t size); // Room for size bytes in total. False when the heap has no block that big
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *source, size_t size) override;
+  uint8_t *release(); // Hands the buffer over, the caller frees it. The HeapPrint is empty afterwards
+  size_t size() const { return length; }
+  bool failed() const { return failure; } // An allocation failed, what didn't fit was dropped
+
+  using Print::write;
+
+private:
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+  bool failure;
+};
@@ -0,0 +1,99 @@
+#include "command_queue.h"
+#include "modbus_engine.h"
+
+struct Command
+{
+  uint16_t address;
+  int16_t value;
+};
+
+enum CommandState
+{
+  commandStateIdle = 0,
+  commandStateWriting,
+  commandStateReading
+};
+
+static Command commandQueue[COMMAND_QUEUE_SIZE]; // Oldest first
+static uint8_t commandCount = 0;
+static Command commandCurrent;
+static int16_t commandReadValue;
+static CommandState commandState = commandStateIdle;
+static CommandCallback commandCallback = NULL;
+
+void commandBegin(CommandCallback callback)
+{
+  commandCallback = callback;
+}
+
+bool commandWrite(uint16_t address, int16_t value)
+{
+  for (uint8_t i = 0; i < commandCount; i++)
+  {
+    if (commandQueue[i].address == address)
+    {
+      commandQueue[i].value = value;
+      return true;
+    }
+  }
+  if (commandCount >= COMMAND_QUEUE_SIZE)
+  {
+    return false;
+  }
+  commandQueue[commandCount].address = address;
+  commandQueue[commandCount].value = value;
+  commandCount++;
+  return true;
+}
+
+static void commandFinish(int16_t value, uint8_t result)
+{
+  commandState = commandStateIdle;
+  if (commandCallback != NULL)
+  {
+    commandCallback(commandCurrent.address, value, result);
+  }
+}
+
+static void commandReadDone(ModbusTransaction &transaction)
+{
+  commandFinish(commandReadValue, transaction.result);
+}
+
+static void commandWritten(ModbusTransaction &transaction)
+{
+  if (transaction.result != MODBUS_SUCCESS)
+  {
+    commandFinish(commandCurrent.value, transaction.result);
+    return;
+  }
+  ModbusTransaction t = {};
+  t.function = MODBUS_READ_HOLDING;
+  t.address = commandCurrent.address;
+  t.count = 1;
+  t.values = &commandReadValue;
+  t.callback = commandReadDone;
+  t.priority = true;
+  commandState = commandStateReading;
+  if (!modbusSubmit(t))
+  {
+    // Written, but no room to confirm it. Report the value sent
+    commandFinish(commandCurrent.value, MODBUS_SUCCESS);
+  }
+}
+
+void commandLoop()
+{
+  if (commandState != commandStateIdle || commandCount == 0)
+  {
+    return;
+  }
+  if (!modbusWrite(commandQueue[0].address, commandQueue[0].value, commandWritten, NULL))
+  {
+    return; // Modbus queue full, try again next time
+  }
+  commandCurrent = commandQueue[0];
+  commandCount--;
+  memmove(commandQueue, commandQueue + 1, commandCount * sizeof(Command));
+  commandState = commandStateWriting;
+}
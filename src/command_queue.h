@@ -0,0 +1,18 @@
+/*
+ *  Command queue.
+ *  Writes requested over MQTT are queued here and handed to the Modbus engine one at a time with priority,
+ *  so they don't wait behind the poller. A write to a register that is already waiting replaces the queued
+ *  value, a slider sending many values in a row costs one write. After each write the register is read
+ *  back and the value found is reported to the callback.
+ */
+#pragma once
+#include <Arduino.h>
+
+#define COMMAND_QUEUE_SIZE 8 // Registers with a write waiting
+
+// value is the value read back, result a MODBUS_ result code of the write or the read back
+typedef void (*CommandCallback)(uint16_t address, int16_t value, uint8_t result);
+
+void commandBegin(CommandCallback callback);
+bool commandWrite(uint16_t address, int16_t value); // Holding register. False when the queue is full
+void commandLoop();
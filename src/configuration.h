@@ -27,7 +27,58 @@
 #define MQTT_USERNAME NULL // Username for the MQTT broker (NULL if no username is required)
 #define MQTT_PASSWORD NULL // Password for the MQTT broker (NULL if no password is required)
 #endif
-#define MQTT_SEND_INTERVAL 600000 // normally set to 180000 milliseconds = 3 minutes. Define as you like
+// Poll schedule. Seconds between reads of each group, or POLL_AT_BOOT to read a group once after boot.
+// Groups not listed are not polled. The schedule can be changed at runtime over MQTT, see README
+#define POLL_SCHEDULE             \
+  POLL_GROUP(temp1, 60)           \
+  POLL_GROUP(temp2, 60)           \
+  POLL_GROUP(temp3, 60)           \
+  POLL_GROUP(inputairtemp, 60)    \
+  POLL_GROUP(display, 60)         \
+  POLL_GROUP(info, 60)            \
+  POLL_GROUP(control, 300)        \
+  POLL_GROUP(speed, 60)           \
+  POLL_GROUP(alarm, 300)          \
+  POLL_GROUP(user, 600)           \
+  POLL_GROUP(program, 3600)       \
+  POLL_GROUP(app, POLL_AT_BOOT)
+// Live mode. Polls some groups fast for a while, e.g. during commissioning. Started by ventilation/cmd/live or /live
+#define LIVE_GROUPS \
+  LIVE_GROUP(temp1) \
+  LIVE_GROUP(temp2) \
+  LIVE_GROUP(temp3) \
+  LIVE_GROUP(speed) \
+  LIVE_GROUP(display1) \
+  LIVE_GROUP(display2)
+#define LIVE_PERIOD 1000       // Milliseconds between reads of a live group
+#define LIVE_MAX_DURATION 3600 // Seconds, longer requests are cut to this
+// Aggregated groups are read every AGGREGATE_SAMPLE milliseconds. Their period above becomes the reporting interval,
+// at which the min, max and mean of the samples are published instead of single readings. Catches defrost cycles and dips
+#define AGGREGATE_GROUPS     \
+  AGGREGATE_GROUP(temp1)     \
+  AGGREGATE_GROUP(temp2)     \
+  AGGREGATE_GROUP(temp3)     \
+  AGGREGATE_GROUP(info)
+#define AGGREGATE_SAMPLE 5000
+// Groups read right after boot, the rest of the schedule starts spread over the first 30 seconds
+#define BOOT_GROUPS \
+  BOOT_GROUP(temp1) \
+  BOOT_GROUP(temp2) \
+  BOOT_GROUP(temp3) \
+  BOOT_GROUP(speed) \
+  BOOT_GROUP(alarm)
+#define BOOT_REUSE_LEASE true // Reconnect to the last access point with the last IP after a reset, skipping the scan and DHCP
+// Report by exception. A value is only published when it has changed since it was last published.
+// Temperatures and humidity must change by more than the deadband, given in 1/100 °C and 1/100 %RH
+#define MQTT_DEADBAND_TEMP 10 // 0.1 °C
+#define MQTT_DEADBAND_RH 50   // 0.5 %RH
+#define MQTT_REFRESH_INTERVAL 3600000 // Publish all values anyway this often. 3600000 milliseconds = 1 hour
+// Payload mode. MQTT_PAYLOAD_TOPICS publishes every register to its own topic, e.g. ventilation/temp/T3_Exhaust.
+// MQTT_PAYLOAD_JSON and MQTT_PAYLOAD_MSGPACK publish one message per group to ventilation/<group> when any of its values changed
+#define MQTT_PAYLOAD_TOPICS 0
+#define MQTT_PAYLOAD_JSON 1
+#define MQTT_PAYLOAD_MSGPACK 2
+#define MQTT_PAYLOAD MQTT_PAYLOAD_TOPICS
 
 
 // Serial port
@@ -38,6 +89,31 @@
 // Modbus address of the unit (possible to be changed via config)
 #define MODBUS_SLAVE_ADDRESS 30 // Default is 30
 
+// Modbus read planning. Groups of the same register type are read in one frame when the
+// hole between them is at most MODBUS_PLAN_MAX_GAP registers and the frame stays within
+// MODBUS_PLAN_MAX_FRAME registers. Set MODBUS_PLAN_MAX_GAP to -1 to read every group on its own
+#define MODBUS_PLAN_MAX_GAP 16
+#define MODBUS_PLAN_MAX_FRAME 32
+
+// HTTP API
+#define HTTP_JSON_PRETTY true // 'false' sends compact JSON, smaller and faster to send
+#define HTTP_CACHE_MAX_AGE 1200000 // /read/<group> answers from the last poll when it is younger than this. 1200000 milliseconds = 20 minutes
+
+// History of polled values kept on the gateway, read with /history
+#define HISTORY_GROUPS \
+  HISTORY_GROUP(temp1) \
+  HISTORY_GROUP(temp2) \
+  HISTORY_GROUP(temp3) \
+  HISTORY_GROUP(speed)
+#define HISTORY_INTERVAL 60     // Seconds, at most one sample per group this often
+#define HISTORY_SIZE 8192       // Bytes of RAM, about 7 hours of the groups above
+#define HISTORY_SPILL true      // Keep blocks that no longer fit in RAM in flash
+#define HISTORY_FILE_SIZE 65536 // Bytes of flash, the file is rotated once so up to twice this is used
+
+// Modbus TCP server for other systems that want raw register access
+#define MODBUS_TCP_PORT 502 // 0 turns the server off
+#define MODBUS_TCP_CACHE_MAX_AGE 10000 // Reads answered from the last poll when it is younger than this, 0 always reads the bus. Milliseconds
+
 #if CONFIGURED == 0
   #error "Default configuration used - won't upload to avoid loosing connection."
 #endif
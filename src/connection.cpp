@@ -0,0 +1,137 @@
+#include "connection.h"
+#include <ESP8266WiFi.h>
+#include "configuration.h"
+#include "timebase.h"
+#include "profiler.h"
+
+static PubSubClient *connectionClient = NULL;
+static ConnectionAttempt connectionAttempt = NULL;
+static ConnectionHandler connectionConnected = NULL;
+static ConnectionStats connectionStatistics;
+static uint64_t connectionLost = 0;    // clockMillis() when the broker was lost, or boot
+static int8_t connectionTimer = -1;      // Next attempt to reach the broker
+static int8_t wifiTimer = -1;            // WiFi restart, when it doesn't come back on its own
+
+static void connectionLed(bool on)
+{
+#if USE_WIFI_LED
+  digitalWrite(WIFI_LED, on ? LOW : HIGH); // Reverse meaning. LOW=LED ON
+#else
+  (void)on;
+#endif
+}
+
+// Next step of the backoff, the attempt starts somewhere in the second half of it
+static void connectionBackoff()
+{
+  uint32_t &backoff = connectionStatistics.backoff;
+  backoff = backoff == 0 ? CONNECT_BACKOFF_MIN : backoff * 2 < CONNECT_BACKOFF_MAX ? backoff * 2 : CONNECT_BACKOFF_MAX;
+  timerStart(connectionTimer, backoff / 2 + random(backoff / 2));
+}
+
+static void connectionTry()
+{
+  ConnectionStats &stats = connectionStatistics;
+  if (stats.state != connectionMqttDown)
+  {
+    return;
+  }
+  stats.mqttAttempts++;
+  // Runs from timerLoop(), outside the MQTT phase of loop()
+  profileBegin(PHASE_MQTT);
+  bool connected = connectionAttempt();
+  profileEnd(PHASE_MQTT);
+  if (connected)
+  {
+    stats.mqttConnects++;
+    uint64_t outage = clockMillis() - connectionLost;
+    stats.lastOutage = outage < UINT32_MAX ? outage : UINT32_MAX;
+    stats.backoff = 0;
+    stats.state = connectionUp;
+    connectionConnected();
+  }
+  else
+  {
+    connectionBackoff();
+  }
+}
+
+// The SDK reconnects by itself, only help it along when that takes too long
+static void wifiRestart()
+{
+  connectionStatistics.wifiAttempts++;
+  WiFi.disconnect();
+  WiFi.config(IPAddress(), IPAddress(), IPAddress()); // Any address setup() took from a cache, DHCP from now on
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  timerStart(wifiTimer, WIFI_CONNECT_TIMEOUT);
+}
+
+void connectionBegin(PubSubClient &client, ConnectionAttempt attempt, ConnectionHandler connected, unsigned long firstTimeout)
+{
+  connectionClient = &client;
+  connectionAttempt = attempt;
+  connectionConnected = connected;
+  connectionClient->setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+  WiFi.setAutoReconnect(true);
+#if USE_WIFI_LED
+  pinMode(WIFI_LED, OUTPUT);
+#endif
+  connectionLed(true);
+  connectionStatistics.state = connectionWifiDown;
+  connectionLost = clockMillis();
+  connectionTimer = timerAdd(connectionTry, 0);
+  wifiTimer = timerAdd(wifiRestart, 0);
+  timerStart(wifiTimer, firstTimeout);
+}
+
+void connectionLoop()
+{
+  if (connectionClient == NULL)
+  {
+    return;
+  }
+  ConnectionStats &stats = connectionStatistics;
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    if (stats.state != connectionWifiDown)
+    {
+      if (stats.state == connectionUp)
+      {
+        connectionLost = clockMillis();
+      }
+      stats.state = connectionWifiDown;
+      timerStop(connectionTimer);
+      timerStart(wifiTimer, WIFI_CONNECT_TIMEOUT);
+      connectionLed(true);
+    }
+    return;
+  }
+  if (stats.state == connectionWifiDown)
+  {
+    stats.wifiConnects++;
+    stats.state = connectionMqttDown;
+    stats.backoff = 0;
+    timerStop(wifiTimer);
+    timerTrigger(connectionTimer);
+    connectionLed(false);
+  }
+
+  if (connectionClient->connected())
+  {
+    connectionClient->loop();
+    return;
+  }
+  if (stats.state == connectionUp)
+  {
+    // Lost the broker, the first attempt is jittered too
+    stats.state = connectionMqttDown;
+    connectionLost = clockMillis();
+    stats.backoff = 0;
+    connectionBackoff();
+  }
+}
+
+const ConnectionStats &connectionStats()
+{
+  return connectionStatistics;
+}
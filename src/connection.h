@@ -0,0 +1,42 @@
+/*
+ *  Connection to WiFi and the MQTT broker.
+ *  Never blocks and never reboots: while WiFi or the broker is away the rest of the gateway keeps running,
+ *  and connection attempts are spaced by an exponential backoff with random jitter, so a restarted broker
+ *  is not hit by every gateway in the building at the same moment. The attempts and WiFi restarts are timer
+ *  jobs, see timebase.h, connectionLoop() only follows the state and serves the client.
+ */
+#pragma once
+#include <Arduino.h>
+#include <PubSubClient.h>
+
+#define CONNECT_BACKOFF_MIN 1000   // Milliseconds before the second attempt, doubled for every further one
+#define CONNECT_BACKOFF_MAX 300000 // Milliseconds
+#define WIFI_CONNECT_TIMEOUT 30000 // Milliseconds WiFi gets to come back on its own before it is restarted
+#define MQTT_SOCKET_TIMEOUT 2      // Seconds to wait for the broker to answer a connect
+#define MQTT_CONNECT_TIMEOUT 1000  // Milliseconds the TCP connect to the broker may block, set on the WiFiClient
+
+enum ConnectionState
+{
+  connectionWifiDown = 0,
+  connectionMqttDown,
+  connectionUp
+};
+
+struct ConnectionStats
+{
+  uint8_t state;         // ConnectionState
+  uint32_t wifiAttempts; // WiFi restarts after WIFI_CONNECT_TIMEOUT
+  uint32_t wifiConnects;
+  uint32_t mqttAttempts;
+  uint32_t mqttConnects;
+  uint32_t backoff;    // Milliseconds until the next attempt may start, current step
+  uint32_t lastOutage; // Milliseconds from losing the broker to being connected again, last time
+};
+
+typedef bool (*ConnectionAttempt)(); // Tries once to connect to the broker. True when connected
+typedef void (*ConnectionHandler)(); // Called after connecting, the stats already count the connect
+
+// firstTimeout: milliseconds the WiFi connect started by setup() gets before it is restarted with DHCP
+void connectionBegin(PubSubClient &client, ConnectionAttempt attempt, ConnectionHandler connected, unsigned long firstTimeout = WIFI_CONNECT_TIMEOUT);
+void connectionLoop();
+const ConnectionStats &connectionStats();
@@ -0,0 +1,145 @@
+#include "fast_boot.h"
+#include <ESP8266WiFi.h>
+#include "register_map.h"
+
+#define BOOT_MAGIC 0x4E4C4231 // "NLB1", change it when BootState changes
+#define BOOT_RTC_BLOCK 32     // First 32 bit block of RTC user memory, eboot keeps the OTA command in blocks 0-31
+
+struct BootState
+{
+  uint32_t magic;
+  uint32_t crc;    // Of everything after this member
+  uint32_t groups; // Groups with values
+  uint32_t ip;     // 0 when no network is cached
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t unused;
+  int16_t values[groupRegisterTotal]; // The groups one after the other, as in register_map.def
+};
+
+static_assert(BOOT_RTC_BLOCK * 4 + sizeof(BootState) <= 512, "RTC user memory is 512 bytes");
+static_assert(sizeof(BootState) % 4 == 0, "RTC memory is written in 32 bit words");
+
+static BootState bootState;
+static uint32_t bootRestored = 0; // Groups still holding the values from before the reboot
+static uint32_t bootTimes[BOOT_PHASES];
+static bool bootCached = false;
+static bool bootDirty = false; // Groups saved since the last write
+
+static uint32_t bootCrc()
+{
+  const uint8_t *data = (const uint8_t *)&bootState.groups;
+  size_t length = sizeof(bootState) - offsetof(BootState, groups);
+  uint32_t crc = 0xFFFFFFFF;
+  while (length--)
+  {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static void bootWrite()
+{
+  bootState.magic = BOOT_MAGIC;
+  bootState.crc = bootCrc();
+  ESP.rtcUserMemoryWrite(BOOT_RTC_BLOCK, (uint32_t *)&bootState, sizeof(bootState));
+  bootDirty = false;
+}
+
+static int bootOffset(int group)
+{
+  int offset = 0;
+  for (int g = 0; g < group; g++)
+  {
+    offset += getGroup(g).count;
+  }
+  return offset;
+}
+
+void bootBegin()
+{
+  if (!ESP.rtcUserMemoryRead(BOOT_RTC_BLOCK, (uint32_t *)&bootState, sizeof(bootState)) || bootState.magic != BOOT_MAGIC || bootState.crc != bootCrc())
+  {
+    memset(&bootState, 0, sizeof(bootState)); // Power on, or another firmware
+  }
+  bootRestored = bootState.groups;
+}
+
+bool bootWifiBegin(const char *ssid, const char *password)
+{
+  if (bootState.ip == 0 || bootState.channel == 0)
+  {
+    return false;
+  }
+  WiFi.config(IPAddress(bootState.ip), IPAddress(bootState.gateway), IPAddress(bootState.subnet), IPAddress(bootState.dns));
+  WiFi.begin(ssid, password, bootState.channel, bootState.bssid);
+  bootCached = true;
+  return true;
+}
+
+void bootSaveNetwork()
+{
+  uint32_t ip = WiFi.localIP();
+  uint8_t *bssid = WiFi.BSSID();
+  uint8_t channel = WiFi.channel();
+  if (ip == bootState.ip && channel == bootState.channel && memcmp(bssid, bootState.bssid, 6) == 0)
+  {
+    return;
+  }
+  bootState.ip = ip;
+  bootState.gateway = WiFi.gatewayIP();
+  bootState.subnet = WiFi.subnetMask();
+  bootState.dns = WiFi.dnsIP();
+  memcpy(bootState.bssid, bssid, 6);
+  bootState.channel = channel;
+  bootWrite();
+}
+
+void bootSaveGroup(int group, const int16_t *values)
+{
+  GroupDesc desc = getGroup(group);
+  memcpy(bootState.values + bootOffset(group), values, desc.count * sizeof(int16_t));
+  bootState.groups |= 1UL << group;
+  bootRestored &= ~(1UL << group);
+  bootDirty = true;
+}
+
+void bootFlush()
+{
+  if (bootDirty)
+  {
+    bootWrite();
+  }
+}
+
+const int16_t *bootRestoredValues(int group)
+{
+  return bootRestored & (1UL << group) ? bootState.values + bootOffset(group) : NULL;
+}
+
+bool bootMark(BootPhase phase)
+{
+  if (bootTimes[phase] != 0)
+  {
+    return false;
+  }
+  bootTimes[phase] = millis() | 1; // Never 0
+  return true;
+}
+
+uint32_t bootTime(BootPhase phase)
+{
+  return bootTimes[phase];
+}
+
+bool bootCachedNetwork()
+{
+  return bootCached;
+}
@@ -0,0 +1,30 @@
+/*
+ *  Fast boot.
+ *  Keeps the access point, channel and IP lease of the last connection and the last values of every polled
+ *  group in RTC memory, which survives a reset or ESP.restart() but not a power cycle. At the next boot WiFi
+ *  connects straight to the cached access point with the cached lease instead of scanning and asking DHCP,
+ *  and the kept values can be published as soon as the broker is reached. Also times the boot phases.
+ */
+#pragma once
+#include <Arduino.h>
+
+#define BOOT_WIFI_TIMEOUT 5000 // Milliseconds on the cached access point before falling back to a scan and DHCP
+
+enum BootPhase
+{
+  BOOT_WIFI,    // WiFi connected
+  BOOT_MQTT,    // Broker connected
+  BOOT_READ,    // First group read
+  BOOT_PUBLISH, // First group published
+  BOOT_PHASES
+};
+
+void bootBegin();                                           // Loads RTC memory, first thing in setup()
+bool bootWifiBegin(const char *ssid, const char *password); // Starts connecting with the cached network, false when there is none
+void bootSaveNetwork();                                     // The current access point and lease, once connected
+void bootSaveGroup(int group, const int16_t *values);       // group.count values as read from the bus, kept by bootFlush()
+void bootFlush();                                           // Writes the saved groups to RTC memory, once per poll cycle
+const int16_t *bootRestoredValues(int group);               // Values kept over the reboot, NULL when none or already replaced
+bool bootMark(BootPhase phase);                             // True the first time the phase is reached
+uint32_t bootTime(BootPhase phase);                         // Milliseconds since boot, 0 until reached
+bool bootCachedNetwork();                                   // The cached network was used
@@ -0,0 +1,347 @@
+#include "history.h"
+#include <LittleFS.h>
+#include "configuration.h"
+#include "register_map.h"
+
+#define HISTORY_BLOCKS (HISTORY_SIZE / HISTORY_BLOCK_SIZE)
+#define HISTORY_MAX_RECORD (1 + 5 + MAX_REG_SIZE * 3) // Group, time and worst case register differences
+
+struct HistoryBlock
+{
+  uint32_t start;  // Seconds since boot, time of the first sample is stored against it
+  uint16_t length; // Bytes used of data
+  uint8_t data[HISTORY_BLOCK_SIZE - 6];
+};
+
+static_assert(sizeof(HistoryBlock) == HISTORY_BLOCK_SIZE, "History blocks are written to flash as they are");
+static_assert(HISTORY_BLOCKS >= 2, "HISTORY_SIZE holds less than 2 blocks");
+
+static HistoryBlock historyBlocks[HISTORY_BLOCKS];
+static uint8_t historyFirst = 0; // Oldest block
+static uint8_t historyCount = 0;
+static uint32_t historyDropped = 0; // Blocks moved out of RAM since boot, RAM block n is historyFirst + n - historyDropped
+static uint32_t historyGroups = 0;
+static uint32_t historyLast[reqmax]; // Seconds of the last sample of each group
+static uint32_t historySampled = 0;  // Groups with a sample since boot
+
+// Encoder state of the newest block
+static uint32_t historyTime = 0;
+static uint32_t historySeen = 0; // Groups with a sample in the newest block
+static int16_t historyPrevious[regmax];
+
+static uint8_t *historyPutVarint(uint8_t *p, uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    *p++ = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  *p++ = value;
+  return p;
+}
+
+static uint32_t historyGetVarint(const uint8_t *&p)
+{
+  uint32_t value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7)
+  {
+    uint8_t b = *p++;
+    value |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+    {
+      break;
+    }
+  }
+  return value;
+}
+
+// Small differences of either sign become small numbers: 0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4 ...
+static uint32_t historyZigzag(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t historyUnzigzag(uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// Keep the oldest block in flash before it is overwritten, the file is rotated once it is full
+static void historySpill(const HistoryBlock &block)
+{
+#if HISTORY_SPILL
+  File file = LittleFS.open(HISTORY_FILE, "a");
+  if (!file)
+  {
+    return;
+  }
+  if (file.size() + sizeof(block) > HISTORY_FILE_SIZE)
+  {
+    file.close();
+    LittleFS.remove(HISTORY_FILE_OLD);
+    LittleFS.rename(HISTORY_FILE, HISTORY_FILE_OLD);
+    file = LittleFS.open(HISTORY_FILE, "a");
+    if (!file)
+    {
+      return;
+    }
+  }
+  file.write((const uint8_t *)&block, sizeof(block));
+  file.close();
+#else
+  (void)block;
+#endif
+}
+
+static HistoryBlock &historyNewBlock(uint32_t seconds)
+{
+  if (historyCount == HISTORY_BLOCKS)
+  {
+    historySpill(historyBlocks[historyFirst]);
+    historyFirst = (historyFirst + 1) % HISTORY_BLOCKS;
+    historyCount--;
+    historyDropped++;
+  }
+  HistoryBlock &block = historyBlocks[(historyFirst + historyCount) % HISTORY_BLOCKS];
+  historyCount++;
+  block.start = seconds;
+  block.length = 0;
+  historyTime = seconds;
+  historySeen = 0;
+  return block;
+}
+
+void historyBegin(uint32_t groups)
+{
+  historyGroups = groups;
+#if HISTORY_SPILL
+  // Times are seconds since boot, what is left from the last boot can't be placed
+  LittleFS.begin();
+  LittleFS.remove(HISTORY_FILE);
+  LittleFS.remove(HISTORY_FILE_OLD);
+#endif
+}
+
+void historyAdd(int group, const int16_t *values, uint32_t seconds)
+{
+  uint32_t bit = 1UL << group;
+  if (!(historyGroups & bit) || ((historySampled & bit) && seconds - historyLast[group] < HISTORY_INTERVAL))
+  {
+    return;
+  }
+  historyLast[group] = seconds;
+  historySampled |= bit;
+
+  GroupDesc desc = getGroup(group);
+  HistoryBlock *block = historyCount > 0 ? &historyBlocks[(historyFirst + historyCount - 1) % HISTORY_BLOCKS] : NULL;
+  if (block == NULL || (size_t)block->length + HISTORY_MAX_RECORD > sizeof(block->data))
+  {
+    block = &historyNewBlock(seconds);
+  }
+  uint8_t *p = block->data + block->length;
+  *p++ = group;
+  p = historyPutVarint(p, seconds - historyTime);
+  historyTime = seconds;
+  for (int i = 0; i < desc.registerCount; i++)
+  {
+    int index = desc.firstRegister + i;
+    int16_t value = values[getRegister(index).offset];
+    int32_t previous = (historySeen & bit) ? historyPrevious[index] : 0;
+    p = historyPutVarint(p, historyZigzag(value - previous));
+    historyPrevious[index] = value;
+  }
+  historySeen |= bit;
+  block->length = p - block->data;
+}
+
+// Samples of one group in a block as JSON array elements, comma separated. Returns the new value of first
+static bool historyWriteBlock(Print &out, const HistoryBlock &block, int group, uint32_t since, bool first)
+{
+  int16_t previous[MAX_REG_SIZE];
+  uint32_t seen = 0;
+  uint32_t time = block.start;
+  const uint8_t *p = block.data;
+  const uint8_t *end = block.data + (block.length <= sizeof(block.data) ? block.length : sizeof(block.data));
+  while (p < end)
+  {
+    uint8_t g = *p++;
+    if (g >= reqmax)
+    {
+      break; // Corrupt, skip the rest of the block
+    }
+    time += historyGetVarint(p);
+    GroupDesc desc = getGroup(g);
+    bool wanted = g == group && time >= since;
+    if (wanted)
+    {
+      out.print(first ? "[" : ",[");
+      out.print(time);
+      first = false;
+    }
+    for (int i = 0; i < desc.registerCount; i++)
+    {
+      int32_t difference = historyUnzigzag(historyGetVarint(p));
+      if (g != group)
+      {
+        continue;
+      }
+      int16_t value = ((seen & 1) ? previous[i] : 0) + difference;
+      previous[i] = value;
+      if (wanted)
+      {
+        out.print(',');
+        uint8_t format = getRegister(desc.firstRegister + i).format;
+        if (format == FORMAT_TEMP || format == FORMAT_HUMIDITY || format == FORMAT_SCALED)
+        {
+          out.print(value / 100.0, 2);
+        }
+        else
+        {
+          out.print(value);
+        }
+      }
+    }
+    if (g == group)
+    {
+      seen = 1;
+    }
+    if (wanted)
+    {
+      out.print(']');
+    }
+  }
+  return first;
+}
+
+enum HistoryPart
+{
+  historyPartHead,
+  historyPartOld,
+  historyPartFile,
+  historyPartRam,
+  historyPartTail
+};
+
+// Blocks of a file from cursor.block on, as many as budget allows. False once the file has no more
+static bool historyWriteFile(Print &out, const char *path, HistoryCursor &cursor, uint8_t &budget)
+{
+#if HISTORY_SPILL
+  File file = LittleFS.open(path, "r");
+  if (!file || !file.seek(cursor.block * sizeof(HistoryBlock)))
+  {
+    return false;
+  }
+  static HistoryBlock block; // Too big for the stack
+  for (; budget > 0; budget--)
+  {
+    if (file.read((uint8_t *)&block, sizeof(block)) != (int)sizeof(block))
+    {
+      return false;
+    }
+    cursor.first = historyWriteBlock(out, block, cursor.group, cursor.since, cursor.first);
+    cursor.block++;
+  }
+  return true;
+#else
+  (void)out;
+  (void)path;
+  (void)cursor;
+  (void)budget;
+  return false;
+#endif
+}
+
+// Next recorded group at or after group that was asked for, reqmax when there is none
+static int8_t historyNextGroup(const HistoryCursor &cursor, int group)
+{
+  while (group < reqmax && (!(historyGroups & (1UL << group)) || (cursor.only >= 0 && cursor.only != group)))
+  {
+    group++;
+  }
+  return group;
+}
+
+static void historyWriteHead(Print &out, int group)
+{
+  GroupDesc desc = getGroup(group);
+  out.print(",\"");
+  out.print(FPSTR(desc.name));
+  out.print("\":{\"registers\":[");
+  for (int i = 0; i < desc.registerCount; i++)
+  {
+    out.print(i == 0 ? "\"" : ",\"");
+    out.print(FPSTR(getRegister(desc.firstRegister + i).name));
+    out.print('"');
+  }
+  out.print("],\"samples\":[");
+}
+
+void historyStart(HistoryCursor &cursor, int group, uint32_t since, uint32_t now)
+{
+  cursor.only = group;
+  cursor.since = since;
+  cursor.now = now;
+  cursor.group = -1; // Before the first group, the opening brace is due
+  cursor.part = historyPartHead;
+  cursor.block = 0;
+  cursor.first = true;
+}
+
+bool historyWriteNext(Print &out, HistoryCursor &cursor)
+{
+  if (cursor.group < 0)
+  {
+    out.print("{\"now\":");
+    out.print(cursor.now);
+    cursor.group = historyNextGroup(cursor, 0);
+  }
+  uint8_t budget = HISTORY_SLICE;
+  while (budget > 0 && cursor.group < reqmax)
+  {
+    switch (cursor.part)
+    {
+    case historyPartHead:
+      historyWriteHead(out, cursor.group);
+      cursor.first = true;
+      cursor.part = historyPartOld;
+      cursor.block = 0;
+      break;
+    case historyPartOld:
+    case historyPartFile:
+      if (!historyWriteFile(out, cursor.part == historyPartOld ? HISTORY_FILE_OLD : HISTORY_FILE, cursor, budget))
+      {
+        cursor.part++;
+        cursor.block = cursor.part == historyPartRam ? historyDropped : 0;
+      }
+      break;
+    case historyPartRam:
+      if (cursor.block < historyDropped)
+      {
+        cursor.block = historyDropped; // Moved to flash after the file was read
+      }
+      if (cursor.block - historyDropped < historyCount)
+      {
+        const HistoryBlock &ram = historyBlocks[(historyFirst + cursor.block - historyDropped) % HISTORY_BLOCKS];
+        cursor.first = historyWriteBlock(out, ram, cursor.group, cursor.since, cursor.first);
+        cursor.block++;
+        budget--;
+      }
+      else
+      {
+        cursor.part = historyPartTail;
+      }
+      break;
+    default:
+      out.print("]}");
+      cursor.group = historyNextGroup(cursor, cursor.group + 1);
+      cursor.part = historyPartHead;
+      break;
+    }
+  }
+  if (cursor.group < reqmax)
+  {
+    return true;
+  }
+  out.println('}');
+  return false;
+}
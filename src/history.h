@@ -0,0 +1,37 @@
+/*
+ *  Time series of polled values kept on the gateway, so an outage of WiFi or MQTT leaves no gap.
+ *  Samples are stored in blocks of HISTORY_BLOCK_SIZE bytes. Within a block every value is the varint
+ *  encoded difference to the previous sample of its register, which takes one or two bytes for slowly
+ *  changing temperatures. The first sample of a group in a block is stored against 0, so every block can
+ *  be decoded on its own and the oldest can be dropped or written to flash when RAM is full.
+ *  Times are seconds since boot. The flash copy only covers the current boot.
+ *  Reading it back goes a few blocks at a time through a HistoryCursor, so a long history never holds up the loop.
+ */
+#pragma once
+#include <Arduino.h>
+
+#define HISTORY_BLOCK_SIZE 256
+#define HISTORY_FILE "/history.bin"
+#define HISTORY_FILE_OLD "/history.old"
+#define HISTORY_SLICE 4 // Blocks decoded per historyWriteNext() call
+
+void historyBegin(uint32_t groups); // Mask of the groups to record
+// Values of a group as read from the bus. Kept when the group is recorded and its last sample is old enough
+void historyAdd(int group, const int16_t *values, uint32_t seconds);
+// Position in the JSON text of the history, see historyStart()
+struct HistoryCursor
+{
+  int8_t only;       // Group asked for, -1 for all
+  uint32_t since;
+  uint32_t now;      // Seconds when the request came
+  int8_t group;      // Group being written, reqmax once all are
+  uint8_t part;      // Head, old file, file, RAM or tail of that group
+  uint32_t block;    // Next block of the part, RAM blocks are counted since boot
+  bool first;        // No sample of the group written yet
+};
+
+// Samples of a group, or all groups for -1, taken at or after since
+void historyStart(HistoryCursor &cursor, int group, uint32_t since, uint32_t now);
+// Write the next few blocks as JSON and move the cursor on. False once the text is complete.
+// Blocks that move from RAM to flash in between are left out rather than written twice
+bool historyWriteNext(Print &out, HistoryCursor &cursor);
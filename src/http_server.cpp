@@ -0,0 +1,406 @@
+#include "http_server.h"
+#include "configuration.h"
+#include "buffered_print.h"
+
+#define HTTP_READ_BUDGET 64  // Bytes parsed per connection and loop pass
+#define HTTP_HEADER_SIZE 128 // Room for the response header
+#define HTTP_CHUNKED ((size_t)-1) // Length of a streamed body
+
+enum HttpState
+{
+  httpStateFree,
+  httpStateReading,  // Waiting for the request line
+  httpStateHandling, // Handed to the handler, waiting for httpRespond()
+  httpStateSending,  // Response rendered, waiting for the client to take it
+};
+
+struct HttpConnection
+{
+  WiFiClient client;
+  uint8_t state;
+  int8_t part; // Path part being read, -1 before the first '/', HTTP_REQUEST_PARTS once in the query
+  unsigned long started; // millis() of the accept, or of the last progress while sending
+  HttpRequest request;
+  uint8_t *output; // Rendered response on the heap while sending, the current chunk of a streamed one
+  size_t outputLength;
+  size_t outputSent;
+  HttpStreamWriter stream; // Writes the rest of a streamed body, NULL once it is complete
+  void *cursor;            // Position of stream in the body, on the heap
+};
+
+static WiFiServer *httpServer = NULL;
+static HttpHandler httpHandler = NULL;
+static HttpConnection httpConnections[HTTP_MAX_CLIENTS];
+
+void httpBegin(uint16_t port, HttpHandler handler)
+{
+  static WiFiServer server(port);
+  httpServer = &server;
+  httpHandler = handler;
+  httpServer->begin();
+}
+
+static void httpClose(HttpConnection &connection)
+{
+  connection.client.stop();
+  connection.state = httpStateFree;
+  free(connection.output);
+  connection.output = NULL;
+  free(connection.cursor);
+  connection.cursor = NULL;
+  connection.stream = NULL;
+}
+
+static void httpAccept()
+{
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++)
+  {
+    HttpConnection &connection = httpConnections[i];
+    if (connection.state != httpStateFree)
+    {
+      continue;
+    }
+    WiFiClient client = httpServer->available();
+    if (!client)
+    {
+      return;
+    }
+    connection.client = client;
+    connection.client.setTimeout(HTTP_WRITE_TIMEOUT);
+    connection.state = httpStateReading;
+    connection.part = -1;
+    connection.started = millis();
+    memset(connection.request.part, 0, sizeof(connection.request.part));
+    memset(connection.request.query, 0, sizeof(connection.request.query));
+  }
+}
+
+// Append c to a zero terminated buffer of the given size, drop what does not fit
+static void httpAppend(char *text, size_t size, char c)
+{
+  size_t length = strlen(text);
+  if (length < size - 1)
+  {
+    text[length] = c;
+  }
+}
+
+// Parse what has arrived of "GET /operation/group/address/value?query HTTP/1.1". Returns true once the path is complete
+static bool httpParse(HttpConnection &connection)
+{
+  for (int budget = HTTP_READ_BUDGET; budget > 0 && connection.client.available(); budget--)
+  {
+    char c = connection.client.read();
+    int8_t n = connection.part;
+    bool inQuery = connection.request.query[0] != 0;
+    if (c == '\n')
+    {
+      httpClose(connection); // End of the request line without a path
+      return false;
+    }
+    else if (c == ' ' && (inQuery || (n >= 0 && n < HTTP_REQUEST_PARTS)))
+    {
+      return true;
+    }
+    else if (inQuery)
+    {
+      httpAppend(connection.request.query, HTTP_QUERY_SIZE, c);
+    }
+    else if (c == '?' && n >= 0 && n < HTTP_REQUEST_PARTS)
+    {
+      connection.request.query[0] = '&'; // Leading separator, makes the lookup of the first parameter the same as the rest
+    }
+    else if (c == '/')
+    {
+      if (n < HTTP_REQUEST_PARTS)
+      {
+        connection.part++;
+      }
+    }
+    else if (c != ' ' && n >= 0 && n < HTTP_REQUEST_PARTS)
+    {
+      httpAppend(connection.request.part[n], HTTP_PART_SIZE, c);
+    }
+  }
+  return false;
+}
+
+// Make the next part of a streamed body the output, as one chunk. After the last part comes the empty chunk that
+// ends the body. False when the heap has no room for it
+static bool httpNextChunk(HttpConnection &connection)
+{
+  HeapPrint part;
+  bool more = connection.stream(part, connection.cursor);
+  size_t size = part.size();
+  HeapPrint chunk;
+  chunk.reserve(size + 16);
+  if (size > 0) // An empty chunk would end the body
+  {
+    chunk.print((unsigned long)size, HEX);
+    chunk.print("\r\n");
+    uint8_t *data = part.release();
+    chunk.write(data, size);
+    free(data);
+    chunk.print("\r\n");
+  }
+  if (!more)
+  {
+    chunk.print("0\r\n\r\n");
+    connection.stream = NULL;
+  }
+  if (part.failed() || chunk.failed())
+  {
+    return false;
+  }
+  free(connection.output);
+  connection.outputLength = chunk.size();
+  connection.outputSent = 0;
+  connection.output = chunk.release();
+  return true;
+}
+
+// Hand the client what it takes of the response without blocking, close once all is sent
+static void httpDrain(HttpConnection &connection, unsigned long now)
+{
+  if (!connection.client.connected())
+  {
+    httpClose(connection);
+    return;
+  }
+  // Drop the rest of the request, closing with unread data resets the connection and loses what the client has not taken yet
+  uint8_t discard[HTTP_READ_BUDGET];
+  connection.client.read(discard, sizeof(discard));
+  if (connection.outputSent == connection.outputLength && connection.stream != NULL && !httpNextChunk(connection))
+  {
+    httpClose(connection); // Cut short, the client sees the body end without its last chunk
+    return;
+  }
+  size_t size = connection.outputLength - connection.outputSent;
+  int room = connection.client.availableForWrite();
+  if (size > (size_t)(room > 0 ? room : 0))
+  {
+    size = room > 0 ? room : 0;
+  }
+  if (size > HTTP_WRITE_BUDGET)
+  {
+    size = HTTP_WRITE_BUDGET;
+  }
+  if (size > 0)
+  {
+    size_t written = connection.client.write(connection.output + connection.outputSent, size);
+    connection.outputSent += written;
+    if (written > 0)
+    {
+      connection.started = now;
+    }
+  }
+  if ((connection.outputSent == connection.outputLength && connection.stream == NULL) ||
+      now - connection.started > HTTP_SEND_TIMEOUT)
+  {
+    httpClose(connection);
+  }
+}
+
+void httpLoop()
+{
+  if (httpServer == NULL)
+  {
+    return;
+  }
+  httpAccept();
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++)
+  {
+    HttpConnection &connection = httpConnections[i];
+    switch (connection.state)
+    {
+    case httpStateReading:
+      if (httpParse(connection))
+      {
+        connection.state = httpStateHandling;
+        httpHandler(connection.request);
+      }
+      else if (connection.state == httpStateReading &&
+               (now - connection.started > HTTP_TIMEOUT || !connection.client.connected()))
+      {
+        httpClose(connection);
+      }
+      break;
+    case httpStateHandling:
+      // The slot stays taken until the handler responds, a pending Modbus callback still writes to request.values
+      if (connection.client && now - connection.started > HTTP_RESPONSE_TIMEOUT)
+      {
+        connection.client.stop();
+      }
+      break;
+    case httpStateSending:
+      httpDrain(connection, now);
+      break;
+    }
+  }
+}
+
+// Connection a request belongs to, NULL when it has already been answered
+static HttpConnection *httpFind(HttpRequest &request)
+{
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++)
+  {
+    if (&httpConnections[i].request == &request && httpConnections[i].state == httpStateHandling)
+    {
+      return &httpConnections[i];
+    }
+  }
+  return NULL;
+}
+
+static void httpHeader(Print &out, const char *contentType, size_t length)
+{
+  out.println("HTTP/1.1 200 OK");
+  out.print("Content-Type: ");
+  out.println(contentType);
+  out.println("Connection: close");
+  if (length == HTTP_CHUNKED)
+  {
+    out.println("Transfer-Encoding: chunked");
+  }
+  else
+  {
+    // Fix: To adhere to RFC2616 section 14.13. Calculate length of data to client
+    out.print("Content-Length: ");
+    out.println(length);
+  }
+  out.println();
+}
+
+// Answer that the heap had no room for the response
+static void httpUnavailable(HttpConnection &connection)
+{
+  // Short enough to go out in one write
+  connection.client.print("HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+  httpClose(connection);
+}
+
+// Start sending a rendered response, httpLoop() does the rest
+static void httpSend(HttpConnection &connection, HeapPrint &out)
+{
+  if (out.failed())
+  {
+    httpUnavailable(connection);
+    return;
+  }
+  connection.outputLength = out.size();
+  connection.outputSent = 0;
+  connection.output = out.release();
+  connection.started = millis();
+  connection.state = httpStateSending;
+}
+
+void httpRespond(HttpRequest &request, const JsonDocument &doc)
+{
+  HttpConnection *connection = httpFind(request);
+  if (connection == NULL)
+  {
+    return;
+  }
+  if (!connection->client.connected())
+  {
+    httpClose(*connection);
+    return;
+  }
+  HeapPrint out;
+#if HTTP_JSON_PRETTY
+  size_t length = measureJsonPretty(doc);
+  out.reserve(HTTP_HEADER_SIZE + length);
+  httpHeader(out, "application/json", length);
+  serializeJsonPretty(doc, out);
+#else
+  size_t length = measureJson(doc);
+  out.reserve(HTTP_HEADER_SIZE + length);
+  httpHeader(out, "application/json", length);
+  serializeJson(doc, out);
+#endif
+  httpSend(*connection, out);
+}
+
+void httpRespondText(HttpRequest &request, const char *contentType, HttpBodyWriter body)
+{
+  HttpConnection *connection = httpFind(request);
+  if (connection == NULL)
+  {
+    return;
+  }
+  if (!connection->client.connected())
+  {
+    httpClose(*connection);
+    return;
+  }
+  // The body is written twice, once to learn its length and once for real
+  CountingPrint counter;
+  body(counter);
+  HeapPrint out;
+  out.reserve(HTTP_HEADER_SIZE + counter.count());
+  httpHeader(out, contentType, counter.count());
+  body(out);
+  httpSend(*connection, out);
+}
+
+void httpRespondStream(HttpRequest &request, const char *contentType, HttpStreamWriter writer, const void *cursor, size_t size)
+{
+  HttpConnection *connection = httpFind(request);
+  if (connection == NULL)
+  {
+    return;
+  }
+  if (!connection->client.connected())
+  {
+    httpClose(*connection);
+    return;
+  }
+  connection->cursor = malloc(size);
+  if (connection->cursor == NULL)
+  {
+    httpUnavailable(*connection);
+    return;
+  }
+  memcpy(connection->cursor, cursor, size);
+  connection->stream = writer;
+  HeapPrint out;
+  out.reserve(HTTP_HEADER_SIZE);
+  httpHeader(out, contentType, HTTP_CHUNKED);
+  httpSend(*connection, out);
+}
+
+// Start of the value of name=value in the query, NULL when not given
+static const char *httpQueryFind(const HttpRequest &request, const char *name)
+{
+  size_t length = strlen(name);
+  const char *p = request.query;
+  while ((p = strchr(p, '&')) != NULL)
+  {
+    p++;
+    if (strncmp(p, name, length) == 0 && p[length] == '=')
+    {
+      return p + length + 1;
+    }
+  }
+  return NULL;
+}
+
+int httpQueryInt(const HttpRequest &request, const char *name, int fallback)
+{
+  const char *value = httpQueryFind(request, name);
+  return value != NULL ? atoi(value) : fallback;
+}
+
+char *httpQueryText(const HttpRequest &request, const char *name, char *text, size_t size)
+{
+  const char *value = httpQueryFind(request, name);
+  size_t length = 0;
+  while (value != NULL && value[length] != 0 && value[length] != '&' && length < size - 1)
+  {
+    text[length] = value[length];
+    length++;
+  }
+  text[length] = 0;
+  return text;
+}
@@ -0,0 +1,49 @@
+/*
+ *  Non-blocking HTTP front end.
+ *  Requests are read a few bytes at a time on every call to httpLoop(), so a slow client never stalls the
+ *  firmware. Once the path is complete the handler is called. It may answer right away or start a Modbus
+ *  transaction and answer from its callback with httpRespond(). The response is rendered into a buffer on
+ *  the heap and handed to the client a slice at a time, as much as it takes without blocking. Bodies too big
+ *  for that are streamed: a writer produces the next part whenever the client has taken the last one.
+ */
+#pragma once
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <ArduinoJson.h>
+#include "register_map.h"
+
+#define HTTP_MAX_CLIENTS 4     // Connections served at the same time, further clients wait in the TCP backlog
+#define HTTP_TIMEOUT 5000      // Milliseconds a client gets to send its request line
+#define HTTP_RESPONSE_TIMEOUT 10000 // Milliseconds a request may wait for Modbus before the client is dropped
+#define HTTP_SEND_TIMEOUT 5000 // Milliseconds a client may take none of its response before it is dropped
+#define HTTP_WRITE_TIMEOUT 50  // Milliseconds a write to the client may block, instead of the WiFiClient default of 5 s
+#define HTTP_WRITE_BUDGET 1024 // Bytes sent per connection and loop pass
+#define HTTP_REQUEST_PARTS 4   // Path parts kept: operation, group, address, value
+#define HTTP_PART_SIZE 16
+#define HTTP_QUERY_SIZE 48
+
+struct HttpRequest
+{
+  char part[HTTP_REQUEST_PARTS][HTTP_PART_SIZE]; // Path split at '/', empty when not given
+  char query[HTTP_QUERY_SIZE];                  // Text after the '?' behind a leading '&', e.g. "&fresh=1"
+  int16_t values[MAX_REG_SIZE];                 // Modbus buffer of the request, valid until httpRespond()
+};
+
+typedef void (*HttpHandler)(HttpRequest &request);
+typedef void (*HttpBodyWriter)(Print &out); // Must write the same text every time it is called
+// Writes the next part of a streamed body, a bounded amount per call, and moves cursor on. False once the body is complete
+typedef bool (*HttpStreamWriter)(Print &out, void *cursor);
+
+void httpBegin(uint16_t port, HttpHandler handler);
+void httpLoop();
+// Send doc as the response and close the connection. Must be called exactly once per handled request.
+// The response is rendered right away, doc may go out of scope afterwards
+void httpRespond(HttpRequest &request, const JsonDocument &doc);
+void httpRespondText(HttpRequest &request, const char *contentType, HttpBodyWriter body);
+// Send the body with chunked transfer encoding, written part by part over the following loop passes.
+// The size bytes at cursor are copied and handed to every call of writer
+void httpRespondStream(HttpRequest &request, const char *contentType, HttpStreamWriter writer, const void *cursor, size_t size);
+// Value of name=value in the query, fallback when not given
+int httpQueryInt(const HttpRequest &request, const char *name, int fallback);
+// Copy of the value of name=value in the query, empty when not given. Returns text
+char *httpQueryText(const HttpRequest &request, const char *name, char *text, size_t size);
@@ -15,7 +15,6 @@
   External dependencies. Install using the Arduino library manager:
 
      "Arduino JSON V6 by Benoît Blanchon https://github.com/bblanchon/ArduinoJson - IMPORTANT - Use latest V.6 !!! This code won´t compile with V.5
-     "ModbusMaster by Doc Walker https://github.com/4-20ma/ModbusMaster
      "PubSubClient" by Nick O'Leary https://github.com/knolleary/pubsubclient
 
   Project inspired by https://github.com/DanGunvald/NilanModbus
@@ -24,9 +23,27 @@
 #include <ArduinoJson.h>
 #include <ESP8266WiFi.h>
 #include <ArduinoOTA.h>
-#include <ModbusMaster.h>
 #include <PubSubClient.h>
 #include "configuration.h"
+#include "modbus_engine.h"
+#include "read_planner.h"
+#include "register_map.h"
+#include "alarm_decoder.h"
+#include "http_server.h"
+#include "snapshot.h"
+#include "poll_schedule.h"
+#include "profiler.h"
+#include "value_format.h"
+#include "command_queue.h"
+#include "modbus_tcp.h"
+#include "history.h"
+#include "connection.h"
+#include "outbox.h"
+#include "fast_boot.h"
+#include "aggregate.h"
+#include "timebase.h"
+#include "buffered_print.h"
+#include "poll_cycle.h"
 #define SERIAL_SOFTWARE 1
 #define SERIAL_HARDWARE 2
 #if SERIAL_CHOICE == SERIAL_SOFTWARE
@@ -34,7 +51,6 @@
 // #include <SoftwareSerial.h>
 #endif
 #define HOST "NilanGW-%s" // Change this to whatever you like.
-#define MAX_REG_SIZE 26
 #define VENTSET 1003
 #define RUNSET 1001
 #define MODESET 1002
@@ -42,17 +58,6 @@
 #define PROGRAMSET 500
 #define COMPILED __DATE__ " " __TIME__
 
-#define DEBUG_SCAN_TIME // Turn on/off debugging of scan times
-#ifdef DEBUG_SCAN_TIME
-// Scan time variables
-#define SCAN_COUNT_MAX 100000
-int scanTime = -1; // Used to measure scan times of program
-int scanLast = -1;
-int scanMax = -1;
-int scanMin = 5000; // Set to a fake high number
-double scanMovingAvr = 20;
-int scanCount = 0;
-#endif
 
 #if SERIAL_CHOICE == SERIAL_SOFTWARE
 SoftwareSerial SSerial(SERIAL_SOFTWARE_RX, SERIAL_SOFTWARE_TX); // RX, TX
@@ -64,319 +69,587 @@ char chipID[12];
 const char *mqttServer = MQTT_SERVER;
 const char *mqttUsername = MQTT_USERNAME;
 const char *mqttPassword = MQTT_PASSWORD;
-WiFiServer server(80);
 WiFiClient wifiClient;
-String IPaddress;
+char IPaddress[16];
 PubSubClient mqttClient(wifiClient);
-long lastMsg = -MQTT_SEND_INTERVAL;
-long modbusCooldown = 0;   // Used to limit modbus read/write operations
-int modbusCooldownHit = 0; // Used to limit modbus read/write operations
-int16_t rsBuffer[MAX_REG_SIZE];
-ModbusMaster node;
-
-int16_t AlarmListNumber[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 70, 71, 90, 91, 92};
-String AlarmListText[] = {"NONE", "HARDWARE", "TIMEOUT", "FIRE", "PRESSURE", "DOOR", "DEFROST", "FROST", "FROST", "OVERTEMP", "OVERHEAT", "AIRFLOW", "THERMO", "BOILING", "SENSOR", "ROOM LOW", "SOFTWARE", "WATCHDOG", "CONFIG", "FILTER", "LEGIONEL", "POWER", "T AIR", "T WATER", "T HEAT", "MODEM", "INSTABUS", "T1SHORT", "T1OPEN", "T2SHORT", "T2OPEN", "T3SHORT", "T3OPEN", "T4SHORT", "T4OPEN", "T5SHORT", "T5OPEN", "T6SHORT", "T6OPEN", "T7SHORT", "T7OPEN", "T8SHORT", "T8OPEN", "T9SHORT", "T9OPEN", "T10SHORT", "T10OPEN", "T11SHORT", "T11OPEN", "T12SHORT", "T12OPEN", "T13SHORT", "T13OPEN", "T14SHORT", "T14OPEN", "T15SHORT", "T15OPEN", "T16SHORT", "T16OPEN", "ANODE", "EXCH INFO", "SLAVE IO", "OPT IO", "PRESET", "INSTABUS"};
-
-String req[4]; // operation, group, address, value
-enum ReqTypes
-{
-  reqtemp1 = 0,
-  reqtemp2,
-  reqtemp3,
-  reqalarm,
-  reqtime,
-  reqcontrol,
-  reqspeed,
-  reqairtemp,
-  reqairflow,
-  reqairheat,
-  reqprogram,
-  requser,
-  requser2,
-  reqinfo,
-  reqinputairtemp,
-  reqapp,
-  reqoutput,
-  reqdisplay1,
-  reqdisplay2,
-  reqdisplay,
-  reqmax
-};
-
-String groups[] = {"temp1", "temp2", "temp3", "alarm", "time", "control", "speed", "airtemp", "airflow", "airheat", "program", "user", "user2", "info", "inputairtemp", "app", "output", "display1", "display2", "display"};
-
-// Start address to read from
-int regAddresses[] = {203, 207, 221, 400, 300, 1000, 200, 1200, 1100, 0, 500, 600, 610, 100, 1200, 0, 100, 2002, 2007, 3000};
-
-// How many values to read from based on start address
-// byte regSizes[] = {23, 10, 6, 8, 2, 6, 2, 0, 1, 6, 6, 14, 7, 4, 26, 4, 4, 1};
-byte regSizes[] = {2, 2, 1, 10, 6, 8, 2, 6, 2, 0, 1, 6, 6, 14, 1, 4, 26, 4, 4, 1};
-
-// 0=raw, 1=x, 2 = return 2 characters ASCII,
-// 4=xx, 8= return float dived by 1000,
-byte regTypes[] = {8, 8, 8, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 2, 1, 4, 4, 8};
-
-// Text translation of incoming data of the given address
-char const *regNames[][MAX_REG_SIZE] = {
-    // temp
-    // {"T0_Controller", "T1_Intake", NULL, "T3_Exhaust", "T4_Outlet", NULL, NULL, "T7_Inlet", "T8_Outdoor", NULL, NULL, NULL, NULL, NULL, NULL, "T15_Room", NULL, NULL, NULL, NULL, NULL, "RH", NULL},
-    {"T3_Exhaust", "T4_Outlet"},
-    {"T7_Inlet", "T8_Outdoor", NULL, NULL, NULL, NULL, NULL, NULL, "T15_Room", NULL, NULL, NULL, NULL, NULL, "RH", NULL},
-    {"RH"},
-    // alarm
-    {"Status", "List_1_ID", "List_1_Date", "List_1_Time", "List_2_ID", "List_2_Date", "List_2_Time", "List_3_ID", "List_3_Date", "List_3_Time"},
-    // time
-    {"Second", "Minute", "Hour", "Day", "Month", "Year"},
-    // control
-    {"Type", "RunSet", "ModeSet", "VentSet", "TempSet", "ServiceMode", "ServicePct", "Preset"},
-    // speed
-    {"ExhaustSpeed", "InletSpeed"},
-    // airtemp
-    {"CoolSet", "TempMinSum", "TempMinWin", "TempMaxSum", "TempMaxWin", "TempSummer"},
-    // airflow
-    {"AirExchMode", "CoolVent"},
-    // airheat
-    {},
-    // program
-    {"Program"},
-    // program.user
-    {"UserFuncAct", "UserFuncSet", "UserTimeSet", "UserVentSet", "UserTempSet", "UserOffsSet"},
-    // program.user2 requires the optional print board
-    {"User2FuncAct", "User2FuncSet", "User2TimeSet", "User2VentSet", "User2TempSet", "User2OffsSet"},
-    // info
-    {"UserFunc", "AirFilter", "DoorOpen", "Smoke", "MotorThermo", "Frost_overht", "AirFlow", "P_Hi", "P_Lo", "Boil", "3WayPos", "DefrostHG", "Defrost", "UserFunc_2"},
-    // inputairtemp
-    {"IsSummer", "TempInletSet", "TempControl", "TempRoom", "EffPct", "CapSet", "CapAct"},
-    // app
-    {"Bus.Version", "VersionMajor", "VersionMinor", "VersionRelease"},
-    // output
-    {"AirFlap", "SmokeFlap", "BypassOpen", "BypassClose", "AirCircPump", "AirHeatAllow", "AirHeat_1", "AirHeat_2", "AirHeat_3", "Compressor", "Compressor_2", "4WayCool", "HotGasHeat", "HotGasCool", "CondOpen", "CondClose", "WaterHeat", "3WayValve", "CenCircPump", "CenHeat_1", "CenHeat_2", "CenHeat_3", "CenHeatExt", "UserFunc", "UserFunc_2", "Defrosting"},
-    // display1
-    {"Text_1_2", "Text_3_4", "Text_5_6", "Text_7_8"},
-    // display2
-    {"Text_9_10", "Text_11_12", "Text_13_14", "Text_15_16"},
-    // air bypass
-    {"AirBypass/IsOpen"}};
-
-char const *getName(ReqTypes type, int address)
-{
-  if (address >= 0 && address <= regSizes[type])
-  {
-    return regNames[type][address];
-  }
-  return NULL;
-}
-
-void modbusCool(int coolDownTimeMS)
-{
-  // Fix for breaking out of modbus error loop
-  if ((long)millis() < (long)modbusCooldown)
-  {
-    if (modbusCooldownHit > 50)
-    {
-      ESP.reset();
-    }
-    modbusCooldownHit++;
-    while ((long)millis() < (long)modbusCooldown)
-    {
-      delay(20);
-    }
-  }
-  else if (modbusCooldownHit > 0)
-  {
-    modbusCooldownHit = 0;
-  }
-  modbusCooldown = millis() + coolDownTimeMS;
-}
-
-char WriteModbus(uint16_t addr, int16_t val)
-{
-  modbusCool(200);
-  node.setTransmitBuffer(0, val);
-  char result = 0;
-  result = node.writeMultipleRegisters(addr, 1);
-  return result;
+int8_t refreshTimer = -1; // Job publishing the telemetry every MQTT_REFRESH_INTERVAL
+unsigned long publishSuppressed = 0;  // Publishes skipped because the value did not change
+int modbusErrorPublished = -1;        // Last state published to ventilation/error/modbus
+unsigned long mqttPackets = 0;        // Register value messages published, to compare the payload modes
+unsigned long mqttBytes = 0;          // Size of these messages on the wire
+
+
+long pollHeap = 0;      // Free heap when the running poll cycle started
+long pollHeapDelta = 0; // Change of free heap over the last complete poll cycle
+
+// Report by exception: last value published for each register
+int16_t publishedValues[regmax];
+uint32_t publishedValid[(regmax + 31) / 32]; // Bit per register, set when publishedValues holds a value
+
+static const char *const bootPhaseNames[BOOT_PHASES] = {"wifi", "mqtt", "read", "publish"};
+
+void finishRequest(HttpRequest &request, JsonDocument &doc)
+{
+  JsonObject root = doc.as<JsonObject>();
+  root["operation"] = request.part[0];
+  root["group"] = request.part[1];
+  httpRespond(request, doc);
+}
+
+// Registers of a group from the snapshot cache, with the sequence number and age of the snapshot
+void addGroupValues(JsonObject root, int r)
+{
+  addRegisterValues(root, r, snapshotValues(r));
+  root["sequence"] = snapshotSequence(r);
+  root["age"] = clockMillis() - snapshotTime(r);
 }
 
-char ReadModbus(uint16_t addr, uint8_t sizer, int16_t *vals, int type)
+void respondGroup(HttpRequest &request, int r, bool ok)
 {
-  modbusCool(200);
-  char result = 0;
-  // Make sure type is either 0 or 1
-  switch (type & 1)
+  DynamicJsonDocument doc(responseCapacity);
+  JsonObject root = doc.to<JsonObject>();
+  GroupDesc group = getGroup(r);
+  if (ok)
   {
-  case 0:
-    result = node.readInputRegisters(addr, sizer);
-    break;
-  case 1:
-    result = node.readHoldingRegisters(addr, sizer);
-    break;
+    root["status"] = "Modbus connection OK";
+    addGroupValues(root, r);
   }
-  if (result == node.ku8MBSuccess)
+  else
   {
-    for (int j = 0; j < sizer; j++)
-    {
-      vals[j] = node.getResponseBuffer(j);
-    }
-    return result;
+    root["status"] = "Modbus connection failed";
   }
-  return result;
+  root["requestAddress"] = group.address;
+  root["requestNumber"] = group.count;
+  finishRequest(request, doc);
 }
 
-JsonObject HandleRequest(JsonDocument &doc)
+void readGroupDone(ModbusTransaction &transaction)
 {
-  JsonObject root = doc.to<JsonObject>();
-  ReqTypes r = reqmax;
-  if (req[1] != "")
+  HttpRequest &request = *(HttpRequest *)transaction.context;
+  int r = findGroup(request.part[1]);
+  if (transaction.result == 0)
   {
-    for (int i = 0; i < reqmax; i++)
+    snapshotStore(r, request.values);
+  }
+  respondGroup(request, r, transaction.result == 0);
+}
+
+// Modbus transport counters and latency histograms
+const size_t modbusStatsCapacity = JSON_OBJECT_SIZE(8 + MODBUS_STAT_FUNCTIONS) +
+                                   MODBUS_STAT_FUNCTIONS * (JSON_OBJECT_SIZE(7) + JSON_ARRAY_SIZE(4) + JSON_OBJECT_SIZE(MODBUS_LATENCY_BUCKETS) + MODBUS_LATENCY_BUCKETS * 6);
+
+void addModbusStats(JsonObject root)
+{
+  const ModbusStats &stats = modbusStats();
+  root["bytesSent"] = stats.bytesSent;
+  root["bytesReceived"] = stats.bytesReceived;
+  root["consecutiveErrors"] = stats.consecutiveErrors;
+  root["queuePeak"] = stats.queuePeak;
+  root["gap"] = stats.gap;
+  root["turnaround"] = stats.turnaround;
+  root["backoff"] = stats.backoff;
+  root["reopens"] = stats.reopens;
+  for (uint8_t f = 0; f < MODBUS_STAT_FUNCTIONS; f++)
+  {
+    const ModbusFunctionStats &function = stats.function[f];
+    JsonObject entry = root.createNestedObject(modbusFunctionName(f));
+    entry["success"] = function.success;
+    entry["timeout"] = function.timeout;
+    entry["crc"] = function.crc;
+    JsonArray exception = entry.createNestedArray("exception");
+    for (uint8_t e = 0; e < 4; e++)
+    {
+      exception.add(function.exception[e]);
+    }
+    entry["invalid"] = function.invalid;
+    // Bucket counts keyed by their upper bound in milliseconds, "inf" for the rest
+    JsonObject latency = entry.createNestedObject("latency");
+    for (uint8_t b = 0; b < MODBUS_LATENCY_BUCKETS; b++)
     {
-      if (groups[i] == req[1])
+      char bound[6];
+      uint16_t limit = modbusLatencyBound(b);
+      if (limit == 0)
       {
-        r = (ReqTypes)i;
+        strcpy(bound, "inf");
       }
+      else
+      {
+        itoa(limit, bound, 10);
+      }
+      latency[bound] = function.latency[b];
     }
+    entry["latencySum"] = function.latencySum;
   }
-  char type = regTypes[r];
-  if (req[0] == "read")
-  {
-    int address = 0;
-    int nums = 0;
-    char result = -1;
-    address = regAddresses[r];
-    nums = regSizes[r];
+}
+
+// Values that change by themselves are taken once per request, the metrics text is written twice
+uint32_t metricsHeap = 0;
+unsigned long metricsUptime = 0;
 
-    result = ReadModbus(address, nums, rsBuffer, type);
-    if (result == 0)
+void writeMetrics(Print &out)
+{
+  profileWriteMetrics(out);
+  const ModbusStats &stats = modbusStats();
+  static const char *const results[] = {"success", "timeout", "crc", "exception1", "exception2", "exception3", "exception4", "invalid"};
+  out.println("# HELP nilan_modbus_transactions_total Modbus transactions by function and result");
+  out.println("# TYPE nilan_modbus_transactions_total counter");
+  for (uint8_t f = 0; f < MODBUS_STAT_FUNCTIONS; f++)
+  {
+    const ModbusFunctionStats &function = stats.function[f];
+    const uint32_t counts[] = {function.success, function.timeout, function.crc, function.exception[0], function.exception[1],
+                               function.exception[2], function.exception[3], function.invalid};
+    for (uint8_t r = 0; r < sizeof(counts) / sizeof(counts[0]); r++)
     {
-      root["status"] = "Modbus connection OK";
-      for (int i = 0; i < nums; i++)
-      {
-        char const *name = getName(r, i);
-        if (name != NULL && strlen(name) > 0)
-        {
-          if ((type == 2 && i > 0) || type == 4)
-          {
-            String str = "";
-            str += (char)(rsBuffer[i] & 0x00ff);
-            str = (char)(rsBuffer[i] >> 8) + str;
-            // Remove leading space from one character string
-            str.trim();
-            root[name] = str;
-          }
-          else if (type == 8)
-          {
-            root[name] = rsBuffer[i] / 100.0;
-          }
-          else
-          {
-            root[name] = rsBuffer[i];
-          }
-        }
-      }
+      out.print("nilan_modbus_transactions_total{function=\"");
+      out.print(modbusFunctionName(f));
+      out.print("\",result=\"");
+      out.print(results[r]);
+      out.print("\"} ");
+      out.println(counts[r]);
     }
-    else
+  }
+  out.println("# HELP nilan_modbus_latency_seconds Time from Modbus request to response or timeout");
+  out.println("# TYPE nilan_modbus_latency_seconds histogram");
+  for (uint8_t f = 0; f < MODBUS_STAT_FUNCTIONS; f++)
+  {
+    uint32_t cumulative = 0;
+    for (uint8_t b = 0; b < MODBUS_LATENCY_BUCKETS; b++)
     {
-      root["status"] = "Modbus connection failed";
+      cumulative += stats.function[f].latency[b];
+      out.print("nilan_modbus_latency_seconds_bucket{function=\"");
+      out.print(modbusFunctionName(f));
+      out.print("\",le=\"");
+      if (modbusLatencyBound(b) == 0)
+      {
+        out.print("+Inf");
+      }
+      else
+      {
+        printSeconds(out, modbusLatencyBound(b) * 1000UL);
+      }
+      out.print("\"} ");
+      out.println(cumulative);
     }
-    root["requestAddress"] = address;
-    root["requestNumber"] = nums;
+    out.print("nilan_modbus_latency_seconds_sum{function=\"");
+    out.print(modbusFunctionName(f));
+    out.print("\"} ");
+    printSeconds(out, stats.function[f].latencySum * 1000ULL);
+    out.println();
+    out.print("nilan_modbus_latency_seconds_count{function=\"");
+    out.print(modbusFunctionName(f));
+    out.print("\"} ");
+    out.println(cumulative);
   }
-  else if (req[0] == "set" && req[2] != "" && req[3] != "")
+  out.println("# TYPE nilan_modbus_sent_bytes_total counter");
+  out.print("nilan_modbus_sent_bytes_total ");
+  out.println(stats.bytesSent);
+  out.println("# TYPE nilan_modbus_received_bytes_total counter");
+  out.print("nilan_modbus_received_bytes_total ");
+  out.println(stats.bytesReceived);
+  out.println("# TYPE nilan_modbus_consecutive_errors gauge");
+  out.print("nilan_modbus_consecutive_errors ");
+  out.println(stats.consecutiveErrors);
+  out.println("# TYPE nilan_modbus_gap_seconds gauge");
+  out.print("nilan_modbus_gap_seconds ");
+  printSeconds(out, stats.gap * 1000UL);
+  out.println();
+  out.println("# TYPE nilan_modbus_turnaround_seconds gauge");
+  out.print("nilan_modbus_turnaround_seconds ");
+  printSeconds(out, stats.turnaround * 1000UL);
+  out.println();
+  out.println("# TYPE nilan_modbus_reopens_total counter");
+  out.print("nilan_modbus_reopens_total ");
+  out.println(stats.reopens);
+  out.println("# TYPE nilan_mqtt_published_messages_total counter");
+  out.print("nilan_mqtt_published_messages_total ");
+  out.println(mqttPackets);
+  out.println("# TYPE nilan_mqtt_published_bytes_total counter");
+  out.print("nilan_mqtt_published_bytes_total ");
+  out.println(mqttBytes);
+  const ConnectionStats &connection = connectionStats();
+  out.println("# TYPE nilan_mqtt_connect_attempts_total counter");
+  out.print("nilan_mqtt_connect_attempts_total ");
+  out.println(connection.mqttAttempts);
+  out.println("# TYPE nilan_mqtt_connects_total counter");
+  out.print("nilan_mqtt_connects_total ");
+  out.println(connection.mqttConnects);
+  out.println("# HELP nilan_mqtt_last_outage_seconds Time from losing the broker to being connected again, last time");
+  out.println("# TYPE nilan_mqtt_last_outage_seconds gauge");
+  out.print("nilan_mqtt_last_outage_seconds ");
+  printSeconds(out, connection.lastOutage * 1000ULL);
+  out.println();
+  out.println("# TYPE nilan_mqtt_connected gauge");
+  out.print("nilan_mqtt_connected ");
+  out.println(connection.state == connectionUp ? 1 : 0);
+  out.println("# TYPE nilan_wifi_connects_total counter");
+  out.print("nilan_wifi_connects_total ");
+  out.println(connection.wifiConnects);
+  out.println("# HELP nilan_boot_phase_seconds Time from boot to reaching the phase, 0 until reached");
+  out.println("# TYPE nilan_boot_phase_seconds gauge");
+  for (uint8_t phase = 0; phase < BOOT_PHASES; phase++)
   {
-    int address = atoi(req[2].c_str());
-    int value = atoi(req[3].c_str());
-    char result = WriteModbus(address, value);
-    root["result"] = result;
-    root["address"] = address;
-    root["value"] = value;
+    out.print("nilan_boot_phase_seconds{phase=\"");
+    out.print(bootPhaseNames[phase]);
+    out.print("\"} ");
+    printSeconds(out, bootTime((BootPhase)phase) * 1000ULL);
+    out.println();
+  }
+  out.println("# TYPE nilan_heap_free_bytes gauge");
+  out.print("nilan_heap_free_bytes ");
+  out.println(metricsHeap);
+  out.println("# TYPE nilan_uptime_seconds counter");
+  out.print("nilan_uptime_seconds ");
+  out.println(metricsUptime);
+}
+
+void respondStats(HttpRequest &request)
+{
+  DynamicJsonDocument doc(modbusStatsCapacity + JSON_OBJECT_SIZE(2));
+  addModbusStats(doc.to<JsonObject>());
+  finishRequest(request, doc);
+}
+
+// Every group in the cache in one response. Nothing updates the cache while it is serialized
+void respondAll(HttpRequest &request)
+{
+  const size_t capacity = JSON_OBJECT_SIZE(regmax + reqmax * 3 + 4) + (regmax + reqmax) * 24 + 128;
+  DynamicJsonDocument doc(capacity);
+  JsonObject root = doc.to<JsonObject>();
+  for (int r = 0; r < reqmax; r++)
+  {
+    if (snapshotValid(r))
+    {
+      addGroupValues(root.createNestedObject(FPSTR(getGroup(r).name)), r);
+    }
   }
-  else if (req[0] == "get" && req[1] >= "0" && req[2] > "0")
+  finishRequest(request, doc);
+}
+
+// /set requests waiting for their command, answered from commandDone() with the value read back
+HttpRequest *setRequests[HTTP_MAX_CLIENTS];
+
+// Queue the write of a /set request like a command over MQTT, so it is coalesced and updates the cache
+bool queueSet(HttpRequest &request)
+{
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++)
   {
-    int address = atoi(req[1].c_str());
-    int nums = atoi(req[2].c_str());
-    int type = atoi(req[3].c_str());
-    char result = ReadModbus(address, nums, rsBuffer, type);
-    if (result == 0)
-    // if (true)
+    if (setRequests[i] == NULL)
     {
-      root["status"] = "Modbus connection OK";
-      for (int i = 0; i < nums; i++)
+      if (!commandWrite(atoi(request.part[2]), atoi(request.part[3])))
       {
-        root[String("address" + String(address + i))] = rsBuffer[i];
+        return false;
       }
+      setRequests[i] = &request;
+      return true;
     }
-    else
+  }
+  return false;
+}
+
+// Answer every /set request waiting for the register
+void respondSet(uint16_t address, int16_t value, uint8_t result)
+{
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++)
+  {
+    if (setRequests[i] == NULL || (uint16_t)atoi(setRequests[i]->part[2]) != address)
     {
-      root["status"] = "Modbus connection failed";
+      continue;
     }
+    DynamicJsonDocument doc(responseCapacity);
+    JsonObject root = doc.to<JsonObject>();
     root["result"] = result;
-    root["requestAddress"] = address;
-    root["requestNumber"] = nums;
-    switch (type)
+    root["address"] = address;
+    root["value"] = value;
+    HttpRequest &request = *setRequests[i];
+    setRequests[i] = NULL;
+    finishRequest(request, doc);
+  }
+}
+
+void getDone(ModbusTransaction &transaction)
+{
+  HttpRequest &request = *(HttpRequest *)transaction.context;
+  DynamicJsonDocument doc(responseCapacity);
+  JsonObject root = doc.to<JsonObject>();
+  if (transaction.result == 0)
+  {
+    root["status"] = "Modbus connection OK";
+    for (int i = 0; i < transaction.count; i++)
     {
-    case 0:
-      root["type"] = "Input register";
-      break;
-    case 1:
-      root["type"] = "Holding register";
-      break;
-    default:
-      root["type"] = "Should be 0 or 1 for input/holding register";
+      char key[16];
+      sprintf(key, "address%d", transaction.address + i);
+      root[key] = request.values[i];
     }
   }
-  else if (req[0] == "help" || req[0] == "")
+  else
+  {
+    root["status"] = "Modbus connection failed";
+  }
+  root["result"] = transaction.result;
+  root["requestAddress"] = transaction.address;
+  root["requestNumber"] = transaction.count;
+  switch (atoi(request.part[3]))
   {
-    for (int i = 0; i < reqmax; i++)
+  case 0:
+    root["type"] = "Input register";
+    break;
+  case 1:
+    root["type"] = "Holding register";
+    break;
+  default:
+    root["type"] = "Should be 0 or 1 for input/holding register";
+  }
+  finishRequest(request, doc);
+}
+
+// Groups of LIVE_GROUPS as a mask
+const uint32_t liveDefaultGroups = 0
+#define LIVE_GROUP(group) | (1UL << req##group)
+    LIVE_GROUPS
+#undef LIVE_GROUP
+    ;
+uint32_t livePublished = 0; // Live groups as last published to ventilation/gateway/live
+
+// Seconds left of live mode, 0 when it is off
+void publishLive()
+{
+  char number[12];
+  livePublished = scheduleLiveGroups();
+  mqttClient.publish("ventilation/gateway/live", ultoa(scheduleLiveRemaining(clockMillis()) / 1000, number, 10));
+}
+
+void startLive(uint32_t groups, long seconds)
+{
+  if (seconds < 0)
+  {
+    seconds = 0;
+  }
+  else if (seconds > LIVE_MAX_DURATION)
+  {
+    seconds = LIVE_MAX_DURATION;
+  }
+  scheduleLive(groups, LIVE_PERIOD, seconds * 1000UL);
+  publishLive();
+}
+
+bool writeHistory(Print &out, void *cursor)
+{
+  return historyWriteNext(out, *(HistoryCursor *)cursor);
+}
+
+// /history?group=<group>&since=<seconds since boot>, both optional. /history/<group> works too
+void respondHistory(HttpRequest &request)
+{
+  char group[HTTP_PART_SIZE];
+  httpQueryText(request, "group", group, sizeof(group));
+  if (group[0] == 0)
+  {
+    strcpy(group, request.part[1]);
+  }
+  int only = group[0] != 0 ? findGroup(group) : -1;
+  if (group[0] != 0 && only < 0)
+  {
+    DynamicJsonDocument doc(responseCapacity);
+    doc["status"] = "Unknown group";
+    finishRequest(request, doc);
+    return;
+  }
+  HistoryCursor cursor;
+  historyStart(cursor, only, httpQueryInt(request, "since", 0), clockSeconds());
+  httpRespondStream(request, "application/json", writeHistory, &cursor, sizeof(cursor));
+}
+
+// /live/<seconds> for LIVE_GROUPS, /live/<seconds>/<group> for one group, /live for the state
+void respondLive(HttpRequest &request)
+{
+  DynamicJsonDocument doc(responseCapacity);
+  JsonObject root = doc.to<JsonObject>();
+  int g = request.part[2][0] != 0 ? findGroup(request.part[2]) : -1;
+  if (request.part[2][0] != 0 && g < 0)
+  {
+    root["status"] = "Unknown group";
+  }
+  else if (request.part[1][0] != 0)
+  {
+    startLive(g >= 0 ? 1UL << g : liveDefaultGroups, atol(request.part[1]));
+  }
+  root["seconds"] = scheduleLiveRemaining(clockMillis()) / 1000;
+  JsonArray groups = root.createNestedArray("groups");
+  for (int i = 0; i < reqmax; i++)
+  {
+    if (scheduleLiveGroups() & (1UL << i))
     {
-      root[groups[i]] = "http://../read/" + groups[i];
+      groups.add(FPSTR(getGroup(i).name));
     }
   }
-  root["operation"] = req[0];
-  root["group"] = req[1];
-  return root;
+  finishRequest(request, doc);
 }
 
-void mqttReconnect()
+// Called by the HTTP server for every complete request. Modbus requests are answered from their callback
+void HandleRequest(HttpRequest &request)
 {
-  int numberRetries = 0;
-  while (!mqttClient.connected() && numberRetries < 3)
+  bool queued = true;
+  int r = request.part[1][0] != 0 ? findGroup(request.part[1]) : -1;
+  if (strcmp(request.part[0], "metrics") == 0)
   {
-    if (mqttClient.connect(chipID, mqttUsername, mqttPassword, "ventilation/alive", 1, true, "0"))
+    metricsHeap = ESP.getFreeHeap();
+    metricsUptime = clockSeconds();
+    httpRespondText(request, "text/plain; version=0.0.4", writeMetrics);
+    return;
+  }
+  else if (strcmp(request.part[0], "stats") == 0)
+  {
+    respondStats(request);
+    return;
+  }
+  else if (strcmp(request.part[0], "history") == 0)
+  {
+    respondHistory(request);
+    return;
+  }
+  else if (strcmp(request.part[0], "live") == 0)
+  {
+    respondLive(request);
+    return;
+  }
+  else if (strcmp(request.part[0], "read") == 0 && strcmp(request.part[1], "all") == 0)
+  {
+    respondAll(request);
+    return;
+  }
+  else if (strcmp(request.part[0], "read") == 0 && r >= 0)
+  {
+    GroupDesc group = getGroup(r);
+    // Served from the cache when the poller or an earlier request has read the group recently enough
+    if (snapshotValid(r) && clockMillis() - snapshotTime(r) <= HTTP_CACHE_MAX_AGE && !httpQueryInt(request, "fresh", 0))
     {
-      mqttClient.publish("ventilation/alive", "1", true);
-      mqttClient.subscribe("ventilation/cmd/+");
+      respondGroup(request, r, true);
       return;
     }
-    else
+    queued = modbusRead(group.address, group.count, request.values, group.kind, readGroupDone, &request);
+  }
+  else if (strcmp(request.part[0], "set") == 0 && request.part[2][0] != 0 && request.part[3][0] != 0)
+  {
+    queued = queueSet(request);
+  }
+  else if (strcmp(request.part[0], "get") == 0 && strcmp(request.part[1], "0") >= 0 && strcmp(request.part[2], "0") > 0)
+  {
+    int nums = atoi(request.part[2]);
+    if (nums > MAX_REG_SIZE)
     {
-      delay(1000);
+      nums = MAX_REG_SIZE;
     }
-    numberRetries++;
+    queued = modbusRead(atoi(request.part[1]), nums, request.values, atoi(request.part[3]), getDone, &request);
   }
-  if (numberRetries >= 3)
+  else
   {
-    delay(5000);
-    // Give up and do a reboot
-    ESP.restart();
+    // Answered right away
+    DynamicJsonDocument doc(responseCapacity);
+    JsonObject root = doc.to<JsonObject>();
+    if (strcmp(request.part[0], "read") == 0)
+    {
+      root["status"] = "Unknown group";
+    }
+    else if (strcmp(request.part[0], "help") == 0 || request.part[0][0] == 0)
+    {
+      for (int i = 0; i < reqmax; i++)
+      {
+        GroupDesc group = getGroup(i);
+        char link[40];
+        strcpy_P(link, PSTR("http://../read/"));
+        strcat_P(link, group.name);
+        root[FPSTR(group.name)] = link;
+      }
+      root["all"] = "http://../read/all";
+      root["stats"] = "http://../stats";
+      root["metrics"] = "http://../metrics";
+      root["live"] = "http://../live/600";
+      root["history"] = "http://../history";
+    }
+    finishRequest(request, doc);
+    return;
+  }
+  if (!queued)
+  {
+    DynamicJsonDocument doc(responseCapacity);
+    JsonObject root = doc.to<JsonObject>();
+    root["status"] = "Modbus request rejected";
+    finishRequest(request, doc);
   }
 }
 
-void mqttCallback(char *topic, byte *payload, unsigned int length)
+void publishSchedule();
+
+bool mqttConnect()
 {
-  String inputString;
-  for (unsigned int i = 0; i < length; i++)
+  bootMark(BOOT_WIFI);
+  return mqttClient.connect(chipID, mqttUsername, mqttPassword, "ventilation/alive", 1, true, "0");
+}
+
+void publishConnection();
+void publishGroup(ReqTypes r, const int16_t *values);
+
+void mqttConnected()
+{
+  static bool booted = false;
+  char number[12];
+  mqttClient.publish("ventilation/alive", "1", true);
+  mqttClient.subscribe("ventilation/cmd/+");
+  if (!booted)
+  {
+    booted = true;
+    mqttClient.publish("ventilation/gateway/boot", ultoa(millis(), number, 10));
+  }
+  IPAddress ip = WiFi.localIP();
+  sprintf(IPaddress, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  mqttClient.publish("ventilation/gateway/ip", IPaddress);
+  bootMark(BOOT_MQTT);
+  bootSaveNetwork();
+  // The broker may have lost track of things, start over with a full report
+  memset(publishedValid, 0, sizeof(publishedValid));
+  modbusErrorPublished = -1;
+  // After a reset the values from before it go out right away, the fresh reads follow as changes
+  for (int r = 0; r < reqmax; r++)
   {
-    inputString += (char)payload[i];
+    const int16_t *restored = bootRestoredValues(r);
+    if (restored != NULL && r != reqalarm && !snapshotValid(r))
+    {
+      publishGroup((ReqTypes)r, restored);
+    }
+  }
+  publishSchedule();
+  publishConnection();
+  publishLive();
+  timerTrigger(refreshTimer);
+}
+
+// Queue the write of a command. The retained command is cleared once it is queued, and kept when the queue
+// is full so the broker hands it over again after the next connect. topic must not be the one passed to
+// mqttCallback(), that one lives in the client's buffer which publishing overwrites
+void queueCommand(const char *topic, uint16_t address, int16_t value)
+{
+  if (!commandWrite(address, value))
+  {
+    mqttClient.publish("ventilation/error/command", topic);
+    return;
   }
+  mqttClient.publish(topic, "", true);
+}
+
+void mqttCallback(char *topic, byte *payload, unsigned int length)
+{
+  // Zero terminated copy of the payload, long enough for any valid command
+  char inputString[32];
+  unsigned int inputLength = length < sizeof(inputString) - 1 ? length : sizeof(inputString) - 1;
+  memcpy(inputString, payload, inputLength);
+  inputString[inputLength] = 0;
   // Check if topic is equal to string
   if (strcmp(topic, "ventilation/cmd/ventset") == 0)
   {
     if (length == 1 && payload[0] >= '0' && payload[0] <= '4')
     {
       int16_t speed = payload[0] - '0';
-      WriteModbus(VENTSET, speed);
-      mqttClient.publish("ventilation/cmd/ventset", "", true);
+      queueCommand("ventilation/cmd/ventset", VENTSET, speed);
     }
   }
   else if (strcmp(topic, "ventilation/cmd/modeset") == 0)
@@ -384,8 +657,7 @@ void mqttCallback(char *topic, byte *payload, unsigned int length)
     if (length == 1 && payload[0] >= '0' && payload[0] <= '4')
     {
       int16_t mode = payload[0] - '0';
-      WriteModbus(MODESET, mode);
-      mqttClient.publish("ventilation/cmd/modeset", "", true);
+      queueCommand("ventilation/cmd/modeset", MODESET, mode);
     }
   }
   else if (strcmp(topic, "ventilation/cmd/runset") == 0)
@@ -393,16 +665,14 @@ void mqttCallback(char *topic, byte *payload, unsigned int length)
     if (length == 1 && payload[0] >= '0' && payload[0] <= '1')
     {
       int16_t run = payload[0] - '0';
-      WriteModbus(RUNSET, run);
-      mqttClient.publish("ventilation/cmd/runset", "", true);
+      queueCommand("ventilation/cmd/runset", RUNSET, run);
     }
   }
   else if (strcmp(topic, "ventilation/cmd/tempset") == 0)
   {
     if (length == 4 && payload[0] >= '0' && payload[0] <= '2')
     {
-      WriteModbus(TEMPSET, inputString.toInt());
-      mqttClient.publish("ventilation/cmd/tempset", "", true);
+      queueCommand("ventilation/cmd/tempset", TEMPSET, atoi(inputString));
     }
   }
   else if (strcmp(topic, "ventilation/cmd/programset") == 0)
@@ -410,8 +680,7 @@ void mqttCallback(char *topic, byte *payload, unsigned int length)
     if (length == 1 && payload[0] >= '0' && payload[0] <= '4')
     {
       int16_t program = payload[0] - '0';
-      WriteModbus(PROGRAMSET, program);
-      mqttClient.publish("ventilation/cmd/programset", "", true);
+      queueCommand("ventilation/cmd/programset", PROGRAMSET, program);
     }
   }
   else if (strcmp(topic, "ventilation/cmd/update") == 0)
@@ -425,10 +694,6 @@ void mqttCallback(char *topic, byte *payload, unsigned int length)
         ArduinoOTA.handle();
         delay(200);
       }
-      if (!mqttClient.connected())
-      {
-        mqttReconnect();
-      }
     }
     mqttClient.publish("ventilation/cmd/update", "0");
   }
@@ -440,67 +705,90 @@ void mqttCallback(char *topic, byte *payload, unsigned int length)
       ESP.restart();
     }
   }
-  else if (strcmp(topic, "ventilation/cmd/version") == 0)
+  else if (strcmp(topic, "ventilation/cmd/poll") == 0)
   {
-    if (inputString != String(COMPILED))
+    // {"group":seconds,...} or "default"
+    if (strcmp(inputString, "default") == 0)
     {
-      mqttClient.publish(topic, String(COMPILED).c_str());
+      scheduleDefaults();
+      publishSchedule();
     }
-  }
-  else
-  {
-    mqttClient.publish("ventilation/error/topic", topic);
-  }
-  lastMsg = -MQTT_SEND_INTERVAL;
-}
-
-bool readRequest(WiFiClient &client)
-{
-  req[0] = "";
-  req[1] = "";
-  req[2] = "";
-  req[3] = "";
-
-  int n = -1;
-  while (client.connected())
-  {
-    if (client.available())
+    else if (length > 0)
     {
-      char c = client.read();
-      if (c == '\n')
+      StaticJsonDocument<JSON_OBJECT_SIZE(reqmax) + 256> doc;
+      // Anything but an object, e.g. a bare 60, would apply and save an empty schedule
+      if (deserializeJson(doc, payload, length) || !doc.is<JsonObject>() || !scheduleApply(doc.as<JsonObject>()))
       {
-        return false;
+        mqttClient.publish("ventilation/error/poll", "Invalid schedule");
       }
-      else if (c == '/')
+      publishSchedule();
+      mqttClient.publish("ventilation/cmd/poll", "", true);
+    }
+  }
+  else if (strcmp(topic, "ventilation/cmd/live") == 0)
+  {
+    // Seconds of live mode for LIVE_GROUPS, or {"seconds":600,"groups":["temp1","speed"]}. 0 stops it
+    if (length > 0 && inputString[0] == '{')
+    {
+      StaticJsonDocument<JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(reqmax) + 64> doc;
+      uint32_t groups = 0;
+      bool ok = !deserializeJson(doc, payload, length);
+      for (JsonVariant name : doc["groups"].as<JsonArray>())
       {
-        n++;
+        int g = findGroup(name.as<const char *>());
+        if (g < 0)
+        {
+          ok = false;
+          continue;
+        }
+        groups |= 1UL << g;
       }
-      else if (c != ' ' && n >= 0 && n < 4)
+      if (ok)
       {
-        req[n] += c;
+        startLive(groups, doc["seconds"] | 0L);
       }
-      else if (c == ' ' && n >= 0 && n < 4)
+      else
       {
-        return true;
+        mqttClient.publish("ventilation/error/live", "Invalid live request");
       }
     }
+    else if (length > 0)
+    {
+      startLive(liveDefaultGroups, atol(inputString));
+    }
+    mqttClient.publish("ventilation/cmd/live", "", true);
+  }
+  else if (strcmp(topic, "ventilation/cmd/version") == 0)
+  {
+    if (strcmp(inputString, COMPILED) != 0)
+    {
+      mqttClient.publish(topic, COMPILED);
+    }
+  }
+  else
+  {
+    mqttClient.publish("ventilation/error/topic", topic);
   }
-
-  return false;
 }
 
-void writeResponse(WiFiClient &client, const JsonDocument &doc)
+void commandDone(uint16_t address, int16_t value, uint8_t result);
+void pollRead(int r, const int16_t *values);
+void pollError(uint32_t groups);
+void pollFinish();
+void pollCheck();
+void refreshTelemetry();
+void drainOutbox();
+
+// Last recovery step of the Modbus engine before a reboot
+void modbusReopen()
 {
-  client.println("HTTP/1.1 200 OK");
-  client.println("Content-Type: application/json");
-  client.println("Connection: close");
-  // Fix: To adhere to RFC2616 section 14.13. Calculate length of data to client
-  String response = "";
-  serializeJsonPretty(doc, response);
-  client.print("Content-Length: ");
-  client.println(response.length());
-  client.println();
-  client.print(response);
+#if SERIAL_CHOICE == SERIAL_SOFTWARE
+  SSerial.end();
+  SSerial.begin(19200, SWSERIAL_8E1);
+#else
+  Serial.end();
+  Serial.begin(19200, SERIAL_8E1);
+#endif
 }
 
 void setup()
@@ -508,283 +796,547 @@ void setup()
   char host[64];
   sprintf(chipID, "%08X", ESP.getChipId());
   sprintf(host, HOST, chipID);
-#if USE_WIFI_LED
-  pinMode(WIFI_LED, OUTPUT);
-  digitalWrite(WIFI_LED, LOW); // Reverse meaning. LOW=LED ON
-#endif
-  delay(500);
+  bootBegin();
+  // Connecting goes on in the background, see connectionLoop()
+  WiFi.persistent(false); // Don't write the credentials to flash on every boot
   WiFi.mode(WIFI_STA);
   WiFi.hostname(host);
-  WiFi.begin(ssid, password);
-  while (WiFi.waitForConnectResult() != WL_CONNECTED)
+  if (!BOOT_REUSE_LEASE || !bootWifiBegin(ssid, password))
   {
-    delay(5000);
-    // Give up and do a reboot
-    ESP.restart();
+    WiFi.begin(ssid, password);
   }
-#if USE_WIFI_LED
-  digitalWrite(WIFI_LED, HIGH);
-#endif
   ArduinoOTA.setHostname(host);
   ArduinoOTA.begin();
-  server.begin();
+  httpBegin(80, HandleRequest);
+#if MODBUS_TCP_PORT != 0
+  modbusTcpBegin(MODBUS_TCP_PORT, MODBUS_TCP_CACHE_MAX_AGE);
+#endif
+  scheduleSample(aggregateBegin(0
+#define AGGREGATE_GROUP(group) | (1UL << req##group)
+                                AGGREGATE_GROUPS
+#undef AGGREGATE_GROUP
+                                ),
+                 AGGREGATE_SAMPLE);
+  scheduleBegin(0
+#define BOOT_GROUP(group) | (1UL << req##group)
+                BOOT_GROUPS
+#undef BOOT_GROUP
+  );
+  commandBegin(commandDone);
+  pollBegin(pollRead, pollError, pollFinish);
+  historyBegin(0
+#define HISTORY_GROUP(group) | (1UL << req##group)
+               HISTORY_GROUPS
+#undef HISTORY_GROUP
+  );
 
 #if SERIAL_CHOICE == SERIAL_SOFTWARE
 #warning Compiling for software serial
   SSerial.begin(19200, SWSERIAL_8E1);
-  node.begin(MODBUS_SLAVE_ADDRESS, SSerial);
+  modbusBegin(SSerial, MODBUS_SLAVE_ADDRESS, modbusReopen);
 #elif SERIAL_CHOICE == SERIAL_HARDWARE
 #warning Compiling for hardware serial
   Serial.begin(19200, SERIAL_8E1);
-  node.begin(MODBUS_SLAVE_ADDRESS, Serial);
+  modbusBegin(Serial, MODBUS_SLAVE_ADDRESS, modbusReopen);
 #else
 #error hardware og serial serial port?
 #endif
 
+  wifiClient.setTimeout(MQTT_CONNECT_TIMEOUT); // The default of 5 s would stall loop() on every attempt while the broker is away
   mqttClient.setServer(mqttServer, 1883);
   mqttClient.setCallback(mqttCallback);
-  mqttReconnect();
-  mqttClient.publish("ventilation/gateway/boot", String(millis()).c_str());
-  IPaddress = WiFi.localIP().toString();
-  mqttClient.publish("ventilation/gateway/ip", IPaddress.c_str());
+  connectionBegin(mqttClient, mqttConnect, mqttConnected, bootCachedNetwork() ? BOOT_WIFI_TIMEOUT : WIFI_CONNECT_TIMEOUT);
+  timerAdd(pollCheck, POLL_CHECK_INTERVAL);
+  refreshTimer = timerAdd(refreshTelemetry, MQTT_REFRESH_INTERVAL, MQTT_REFRESH_INTERVAL);
+  timerAdd(drainOutbox, OUTBOX_DRAIN_INTERVAL);
 }
 
-#ifdef DEBUG_SCAN_TIME
-// Scan time is the time then looping part of a program runs in miliseconds.
+// Scan time is the time then looping part of a program runs, published in milliseconds.
 // Rule of thumb is to allow max 20ms to rule the program as runnning "live" and not async
 // Live running programs are relevant when expecting non buffered IO operations with the real world
-void scanTimer()
+void publishScanTime()
 {
-  if (scanCount > SCAN_COUNT_MAX)
+  const PhaseStats &stats = profileStats(PHASE_LOOP);
+  char number[12];
+  mqttClient.publish("ventilation/debug/scanMax", dtostrf(stats.max / 1000.0, 1, 2, number));
+  mqttClient.publish("ventilation/debug/scanMovingAvr", dtostrf(stats.count ? stats.sum / 1000.0 / stats.count : 0, 1, 2, number));
+  uint32_t p99 = profilePercentile(PHASE_LOOP, 99);
+  mqttClient.publish("ventilation/debug/scanP99", dtostrf((p99 != 0 ? p99 : stats.max) / 1000.0, 1, 2, number));
+}
+
+void publishModbusError(int error)
+{
+  if (error != modbusErrorPublished)
   {
-    return;
+    mqttClient.publish("ventilation/error/modbus", error ? "1" : "0");
+    modbusErrorPublished = error;
+  }
+}
+
+// Report by exception. True when the value differs from the one published last by more than its deadband
+bool valueChanged(int index, const RegisterDesc &reg, int16_t value)
+{
+  int deadband = 0;
+  if (reg.format == FORMAT_TEMP)
+  {
+    deadband = MQTT_DEADBAND_TEMP;
+  }
+  else if (reg.format == FORMAT_HUMIDITY)
+  {
+    deadband = MQTT_DEADBAND_RH;
+  }
+  return !(publishedValid[index / 32] & (1UL << (index % 32))) || abs(value - publishedValues[index]) > deadband;
+}
+
+void rememberPublished(int index, int16_t value)
+{
+  publishedValues[index] = value;
+  publishedValid[index / 32] |= 1UL << (index % 32);
+}
+
+// Report by exception. Returns true and remembers the value when it should be published
+bool publishChanged(int index, const RegisterDesc &reg, int16_t value)
+{
+  if (!valueChanged(index, reg, value))
+  {
+    publishSuppressed++;
+    return false;
+  }
+  rememberPublished(index, value);
+  return true;
+}
+
+// Size of an MQTT PUBLISH packet at QoS 0: fixed header, remaining length, topic length, topic and payload
+void countPublish(size_t topicLength, size_t payloadLength)
+{
+  size_t remaining = 2 + topicLength + payloadLength;
+  size_t header = 1;
+  for (size_t n = remaining; n > 0; n >>= 7)
+  {
+    header++;
   }
-  if (scanLast == -1)
+  mqttPackets++;
+  mqttBytes += header + remaining;
+}
+
+void publishTraffic()
+{
+  char number[12];
+  mqttClient.publish("ventilation/gateway/mqtt/packets", ultoa(mqttPackets, number, 10));
+  mqttClient.publish("ventilation/gateway/mqtt/bytes", ultoa(mqttBytes, number, 10));
+}
+
+void publishConnection()
+{
+  const ConnectionStats &stats = connectionStats();
+  char number[12];
+  mqttClient.publish("ventilation/gateway/mqtt/attempts", ultoa(stats.mqttAttempts, number, 10));
+  mqttClient.publish("ventilation/gateway/mqtt/connects", ultoa(stats.mqttConnects, number, 10));
+  mqttClient.publish("ventilation/gateway/mqtt/outage", ultoa(stats.lastOutage, number, 10));
+  mqttClient.publish("ventilation/gateway/wifi/connects", ultoa(stats.wifiConnects, number, 10));
+  mqttClient.publish("ventilation/gateway/mqtt/outbox", ultoa(outboxCount(), number, 10));
+}
+
+// How long the boot took, once the first values are out
+void publishBoot()
+{
+  char topic[40];
+  char number[12];
+  for (uint8_t phase = 0; phase < BOOT_PHASES; phase++)
+  {
+    sprintf(topic, "ventilation/gateway/boot/%s", bootPhaseNames[phase]);
+    mqttClient.publish(topic, ultoa(bootTime((BootPhase)phase), number, 10));
+  }
+  mqttClient.publish("ventilation/gateway/boot/cached", bootCachedNetwork() ? "1" : "0");
+}
+
+void publishModbusStats()
+{
+  DynamicJsonDocument doc(modbusStatsCapacity);
+  addModbusStats(doc.to<JsonObject>());
+  mqttClient.beginPublish("ventilation/gateway/modbus", measureJson(doc), false);
+  BufferedPrint out(mqttClient);
+  serializeJson(doc, out);
+  out.flush();
+  mqttClient.endPublish();
+}
+
+void publishHeap()
+{
+  char number[12];
+  mqttClient.publish("ventilation/gateway/heap/free", ultoa(ESP.getFreeHeap(), number, 10));
+  mqttClient.publish("ventilation/gateway/heap/fragmentation", itoa(ESP.getHeapFragmentation(), number, 10));
+  mqttClient.publish("ventilation/gateway/heap/maxBlock", ultoa(ESP.getMaxFreeBlockSize(), number, 10));
+  mqttClient.publish("ventilation/gateway/heap/pollDelta", ltoa(pollHeapDelta, number, 10));
+}
+
+// Period of every group below ventilation/gateway/poll/, in seconds. 0 is not polled, -1 read once at boot
+void publishSchedule()
+{
+  char number[12];
+  char *tail = mqttTopic + TOPIC_PREFIX_LENGTH;
+  strcpy_P(tail, PSTR("gateway/poll/"));
+  tail += strlen(tail);
+  for (int g = 0; g < reqmax; g++)
   {
-    scanLast = millis();
+    strcpy_P(tail, getGroup(g).name);
+    mqttClient.publish(mqttTopic, ltoa(scheduleGetPeriod(g), number, 10));
+  }
+}
+
+// Publish the alarms of the list not reported before
+void publishAlarms(const int16_t *list)
+{
+  AlarmEvent events[ALARM_SLOTS];
+  uint8_t n = alarmUpdate(list, events);
+  for (uint8_t i = 0; i < n; i++)
+  {
+    StaticJsonDocument<128> doc;
+    char text[12];
+    doc["code"] = events[i].code;
+    formatAlarmCode(events[i].code, text);
+    doc["text"] = text;
+    formatDosDate(events[i].date, text);
+    doc["date"] = text;
+    formatDosTime(events[i].time, text);
+    doc["time"] = text;
+    char payload[96];
+    serializeJson(doc, payload, sizeof(payload));
+    mqttClient.publish("ventilation/alarm/event", payload);
+  }
+}
+
+int32_t publishAge = -1; // Seconds the group waited in the outbox since its first unsent read, -1 when published live
+
+#if MQTT_PAYLOAD != MQTT_PAYLOAD_TOPICS
+// Reused for every group, keeps the poll path off the heap. Big enough for the min, max and mean objects of an aggregate
+StaticJsonDocument<JSON_OBJECT_SIZE(4) + 3 * (JSON_OBJECT_SIZE(MAX_REG_SIZE) + MAX_REG_SIZE * 24)> batchDoc;
+
+// batchDoc to ventilation/<group>
+void publishBatchDoc(ReqTypes r)
+{
+  char *tail = mqttTopic + TOPIC_PREFIX_LENGTH;
+  strcpy_P(tail, getGroup(r).name);
+  // PubSubClient passes every write straight to the socket, ArduinoJson writes one token at a time
+  BufferedPrint out(mqttClient);
+#if MQTT_PAYLOAD == MQTT_PAYLOAD_MSGPACK
+  size_t length = measureMsgPack(batchDoc);
+  mqttClient.beginPublish(mqttTopic, length, false);
+  serializeMsgPack(batchDoc, out);
+#else
+  size_t length = measureJson(batchDoc);
+  mqttClient.beginPublish(mqttTopic, length, false);
+  serializeJson(batchDoc, out);
+#endif
+  out.flush();
+  mqttClient.endPublish();
+  countPublish(strlen(mqttTopic), length);
+}
+
+// The whole group in one message to ventilation/<group>, when any of its values changed
+void publishBatch(ReqTypes r, const int16_t *values)
+{
+  GroupDesc group = getGroup(r);
+  bool changed = false;
+  for (int i = 0; i < group.registerCount && !changed; i++)
+  {
+    RegisterDesc reg = getRegister(group.firstRegister + i);
+    bool alarmList = reg.format == FORMAT_ALARM_CODE || reg.format == FORMAT_DOS_DATE || reg.format == FORMAT_DOS_TIME;
+    changed = !alarmList && valueChanged(group.firstRegister + i, reg, values[reg.offset]);
+  }
+  if (!changed)
+  {
+    publishSuppressed += group.registerCount;
     return;
   }
-  scanTime = millis() - scanLast;
-  if (scanTime > scanMax)
-    scanMax = scanTime;
-  if (scanTime < scanMin)
-    scanMin = scanTime;
-  scanCount++;
-  scanMovingAvr = scanTime * (0.3 / (1 + scanCount)) + scanMovingAvr * (1 - (0.3 / (1 + scanCount)));
-  if (scanCount > SCAN_COUNT_MAX)
+  for (int i = 0; i < group.registerCount; i++)
   {
-    mqttClient.publish("ventilation/debug/scanMin", String(scanMin).c_str());
-    mqttClient.publish("ventilation/debug/scanMax", String(scanMax).c_str());
-    mqttClient.publish("ventilation/debug/scanMovingAvr", String(floor(scanMovingAvr * 100) / 100).c_str());
+    rememberPublished(group.firstRegister + i, values[getRegister(group.firstRegister + i).offset]);
   }
-  scanLast = millis();
+  addRegisterValues(batchDoc.to<JsonObject>(), r, values);
+  if (publishAge >= 0)
+  {
+    batchDoc["age"] = publishAge;
+  }
+  publishBatchDoc(r);
 }
 #endif
 
-void loop()
+// Publish the values of one group read by the poller
+void publishGroup(ReqTypes r, const int16_t *values)
 {
-  ArduinoOTA.handle();
-  WiFiClient client = server.available();
-  if (client)
+  if (!mqttClient.connected())
   {
-    bool success = readRequest(client);
-    if (success)
+    // Sent from the snapshot once the broker is back, see drainOutbox()
+    outboxPut(r, clockSeconds());
+    return;
+  }
+  outboxRemove(r); // Newer than anything waiting in the outbox
+  profileBegin(PHASE_PUBLISH);
+  publishModbusError(0); // no error when connecting through modbus
+#if MQTT_PAYLOAD != MQTT_PAYLOAD_TOPICS
+  publishBatch(r, values);
+#else
+  GroupDesc group = getGroup(r);
+  for (int i = 0; i < group.registerCount; i++)
+  {
+    int index = group.firstRegister + i;
+    RegisterDesc reg = getRegister(index);
+    int16_t value = values[reg.offset];
+    if (reg.format == FORMAT_ALARM_CODE || reg.format == FORMAT_DOS_DATE || reg.format == FORMAT_DOS_TIME)
+    {
+      continue; // The alarm list is reported as events below
+    }
+    if (!publishChanged(index, reg, value))
     {
-      StaticJsonDocument<1000> doc;
-      HandleRequest(doc);
-      writeResponse(client, doc);
+      continue;
     }
-    client.stop();
+    char numberString[12];
+    formatValue(reg, value, numberString);
+    // Humidity is reported below "moist" whatever group it is read with
+    const char *topic = registerTopic(reg.format == FORMAT_HUMIDITY ? (uint8_t)topic_moist : group.topic, reg);
+    mqttClient.publish(topic, numberString);
+    countPublish(strlen(topic), strlen(numberString));
   }
-
-  if (!mqttClient.connected())
+  if (publishAge >= 0)
+  {
+    char numberString[12];
+    char *tail = mqttTopic + TOPIC_PREFIX_LENGTH;
+    strcpy_P(tail, group.name);
+    strcat(tail, "/age");
+    mqttClient.publish(mqttTopic, ultoa(publishAge, numberString, 10));
+  }
+#endif
+  if (r == reqalarm)
+  {
+    publishAlarms(values + 1);
+  }
+  if (bootMark(BOOT_PUBLISH))
   {
-    mqttReconnect();
+    publishBoot();
   }
+  profileEnd(PHASE_PUBLISH);
+}
 
-  if (mqttClient.connected())
+// Min, max and mean of the samples of the interval of an aggregated group. The mean of scaled values goes
+// where the single readings would, min and max below it
+void publishAggregate(ReqTypes r)
+{
+  profileBegin(PHASE_PUBLISH);
+  publishModbusError(0); // no error when connecting through modbus
+  GroupDesc group = getGroup(r);
+  const int16_t *mins = aggregateMin(r);
+  const int16_t *maxs = aggregateMax(r);
+#if MQTT_PAYLOAD != MQTT_PAYLOAD_TOPICS
+  JsonObject root = batchDoc.to<JsonObject>();
+  addRegisterValues(root.createNestedObject("min"), r, mins);
+  addRegisterValues(root.createNestedObject("max"), r, maxs);
+  JsonObject mean = root.createNestedObject("mean");
+  for (int i = 0; i < group.registerCount; i++)
   {
-    mqttClient.loop();
-    long now = millis();
-    if (now - lastMsg > MQTT_SEND_INTERVAL)
+    RegisterDesc reg = getRegister(group.firstRegister + i);
+    bool scaled = reg.format == FORMAT_TEMP || reg.format == FORMAT_HUMIDITY || reg.format == FORMAT_SCALED;
+    mean[FPSTR(reg.name)] = aggregateMean(r, reg.offset) / (scaled ? 100 : 1);
+  }
+  root["samples"] = aggregateCount(r);
+  publishBatchDoc(r);
+#else
+  char numberString[12];
+  for (int i = 0; i < group.registerCount; i++)
+  {
+    RegisterDesc reg = getRegister(group.firstRegister + i);
+    bool scaled = reg.format == FORMAT_TEMP || reg.format == FORMAT_HUMIDITY || reg.format == FORMAT_SCALED;
+    if (!scaled && reg.format != FORMAT_RAW)
     {
-      //  ReqTypes rr[] = {reqtemp, reqcontrol, reqtime, reqoutput, reqspeed, reqalarm, reqinputairtemp, reqprogram, requser, reqdisplay, reqinfo}; // put another register in this line to subscribe
-      ReqTypes rr[] = {reqtemp1, reqtemp2, reqtemp3, reqcontrol, reqalarm, reqinputairtemp, reqprogram, reqdisplay, requser}; // put another register in this line to subscribe
-      for (unsigned int i = 0; i < (sizeof(rr) / sizeof(rr[0])); i++)
-      {
-        ReqTypes r = rr[i];
-        char result = ReadModbus(regAddresses[r], regSizes[r], rsBuffer, regTypes[r]);
-        if (result == 0)
-        {
-          mqttClient.publish("ventilation/error/modbus", "0"); // no error when connecting through modbus
-          for (int i = 0; i < regSizes[r]; i++)
-          {
-            char const *name = getName(r, i);
-            char numberString[10];
-            if (name != NULL && strlen(name) > 0)
-            {
-              String mqttTopic;
-              switch (r)
-              {
-              case reqcontrol:
-                mqttTopic = "ventilation/control/"; // Subscribe to the "control" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case reqtime:
-                mqttTopic = "ventilation/time/"; // Subscribe to the "output" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case reqoutput:
-                mqttTopic = "ventilation/output/"; // Subscribe to the "output" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case reqdisplay:
-                mqttTopic = "ventilation/display/"; // Subscribe to the "input display" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case reqspeed:
-                mqttTopic = "ventilation/speed/"; // Subscribe to the "speed" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case reqalarm:
-                mqttTopic = "ventilation/alarm/"; // Subscribe to the "alarm" register
-
-                switch (i)
-                {
-                case 1: // Alarm.List_1_ID
-                case 4: // Alarm.List_2_ID
-                case 7: // Alarm.List_3_ID
-                  if (rsBuffer[i] > 0)
-                  {
-                    // itoa((rsBuffer[i]), numberString, 10);
-                    sprintf(numberString, "UNKNOWN"); // Preallocate unknown if no match if found
-                    for (unsigned int p = 0; p < (sizeof(AlarmListNumber)); p++)
-                    {
-                      if (AlarmListNumber[p] == rsBuffer[i])
-                      {
-                        //   memset(numberString, 0, sizeof numberString);
-                        //   strcpy (numberString,AlarmListText[p].c_str());
-                        sprintf(numberString, AlarmListText[p].c_str());
-                        break;
-                      }
-                    }
-                  }
-                  else
-                  {
-                    sprintf(numberString, "None"); // No alarm, output None
-                  }
-                  break;
-                case 2: // Alarm.List_1_Date
-                case 5: // Alarm.List_2_Date
-                case 8: // Alarm.List_3_Date
-                  if (rsBuffer[i] > 0)
-                  {
-                    sprintf(numberString, "%d", (rsBuffer[i] >> 9) + 1980);
-                    sprintf(numberString + strlen(numberString), "-%02d", (rsBuffer[i] & 0x1E0) >> 5);
-                    sprintf(numberString + strlen(numberString), "-%02d", (rsBuffer[i] & 0x1F));
-                  }
-                  else
-                  {
-                    sprintf(numberString, "N/A"); // No alarm, output N/A
-                  }
-                  break;
-                case 3: // Alarm.List_1_Time
-                case 6: // Alarm.List_2_Time
-                case 9: // Alarm.List_3_Time
-                  if (rsBuffer[i] > 0)
-                  {
-                    sprintf(numberString, "%02d", rsBuffer[i] >> 11);
-                    sprintf(numberString + strlen(numberString), ":%02d", (rsBuffer[i] & 0x7E0) >> 5);
-                    sprintf(numberString + strlen(numberString), ":%02d", (rsBuffer[i] & 0x11F) * 2);
-                  }
-                  else
-                  {
-                    sprintf(numberString, "N/A"); // No alarm, output N/A
-                  }
-
-                  break;
-                default: // used for Status bit (case 0)
-                  itoa((rsBuffer[i]), numberString, 10);
-                }
-                break;
-              case reqinputairtemp:
-                mqttTopic = "ventilation/inputairtemp/"; // Subscribe to the "inputairtemp" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case reqprogram:
-                mqttTopic = "ventilation/weekprogram/"; // Subscribe to the "week program" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case requser:
-                mqttTopic = "ventilation/user/"; // Subscribe to the "user" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case requser2:
-                mqttTopic = "ventilation/user/"; // Subscribe to the "user2" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case reqinfo:
-                mqttTopic = "ventilation/info/"; // Subscribe to the "info" register
-                itoa((rsBuffer[i]), numberString, 10);
-                break;
-              case reqtemp1:
-                if (strncmp("RH", name, 2) == 0)
-                {
-                  mqttTopic = "ventilation/moist/"; // Subscribe to moisture-level
-                }
-                else
-                {
-                  mqttTopic = "ventilation/temp/"; // Subscribe to "temp" register
-                }
-                dtostrf((rsBuffer[i] / 100.0), 5, 2, numberString);
-                break;
-              case reqtemp2:
-                if (strncmp("RH", name, 2) == 0)
-                {
-                  mqttTopic = "ventilation/moist/"; // Subscribe to moisture-level
-                }
-                else
-                {
-                  mqttTopic = "ventilation/temp/"; // Subscribe to "temp" register
-                }
-                dtostrf((rsBuffer[i] / 100.0), 5, 2, numberString);
-                break;
-              case reqtemp3:
-                if (strncmp("RH", name, 2) == 0)
-                {
-                  mqttTopic = "ventilation/moist/"; // Subscribe to moisture-level
-                }
-                else
-                {
-                  mqttTopic = "ventilation/temp/"; // Subscribe to "temp" register
-                }
-                dtostrf((rsBuffer[i] / 100.0), 5, 2, numberString);
-                break;
-              default:
-                // If not all enumerations possibilities are handled then message are added to the unmapped topic
-                mqttTopic = "ventilation/unmapped/";
-                break;
-              }
-              mqttTopic += (char *)name;
-              mqttClient.publish(mqttTopic.c_str(), numberString);
-            }
-          }
-        }
-        else
-        {
-          mqttClient.publish("ventilation/error/modbus", "1"); // error when connecting through modbus
-        }
-      }
-      lastMsg = now;
-      if (now > (long)1288490187)
-      {
-        // Fix to make sure the command millis() dont overflow. This happens after 50 days and would mess up some logic above
-        // Reboot if ESP has been running for approximately 30 days.
-        ESP.restart();
-      }
+      continue; // Text, no aggregates
     }
+    const char *topic = registerTopic(reg.format == FORMAT_HUMIDITY ? (uint8_t)topic_moist : group.topic, reg);
+    size_t length = strlen(topic);
+    if (scaled)
+    {
+      dtostrf(aggregateMean(r, reg.offset) / 100, 5, 2, numberString);
+    }
+    else
+    {
+      // Raw values are mostly on/off flags. The usual topic keeps its integer payload and tells whether the flag
+      // was on at all during the interval, the share of the interval goes to /mean
+      formatValue(reg, maxs[reg.offset], numberString);
+    }
+    mqttClient.publish(topic, numberString);
+    countPublish(length, strlen(numberString));
+    if (!scaled)
+    {
+      strcpy(mqttTopic + length, "/mean");
+      dtostrf(aggregateMean(r, reg.offset), 1, 2, numberString);
+      mqttClient.publish(topic, numberString);
+      countPublish(length + 5, strlen(numberString));
+    }
+    strcpy(mqttTopic + length, "/min");
+    formatValue(reg, mins[reg.offset], numberString);
+    mqttClient.publish(topic, numberString);
+    countPublish(length + 4, strlen(numberString));
+    strcpy(mqttTopic + length, "/max");
+    formatValue(reg, maxs[reg.offset], numberString);
+    mqttClient.publish(topic, numberString);
+    countPublish(length + 4, strlen(numberString));
   }
-#ifdef DEBUG_SCAN_TIME
-  scanTimer();
+  char *tail = mqttTopic + TOPIC_PREFIX_LENGTH;
+  strcpy_P(tail, group.name);
+  strcat(tail, "/samples");
+  mqttClient.publish(mqttTopic, ultoa(aggregateCount(r), numberString, 10));
 #endif
-}
\ No newline at end of file
+  profileEnd(PHASE_PUBLISH);
+}
+
+// A command has been written and read back. Publish the register, changed or not, as the confirmation
+void commandDone(uint16_t address, int16_t value, uint8_t result)
+{
+  respondSet(address, value, result);
+  if (result != MODBUS_SUCCESS)
+  {
+    publishModbusError(1);
+    return;
+  }
+  int index = findRegister(HOLDING_REGISTER, address);
+  if (index < 0)
+  {
+    return;
+  }
+  RegisterDesc reg = getRegister(index);
+  if (!snapshotValid(reg.group))
+  {
+    scheduleNow(1UL << reg.group); // Not read yet, the whole group gets published with its first read
+    return;
+  }
+  snapshotUpdate(reg.group, reg.offset, value);
+  publishedValid[index / 32] &= ~(1UL << (index % 32));
+  publishGroup((ReqTypes)reg.group, snapshotValues(reg.group));
+}
+
+uint32_t sampledGroups = 0; // Aggregated groups whose first read since boot has been published
+
+// One sample of an aggregated group. The first read after boot is published as it is, so values are out
+// right away. Once the period is over the aggregates are published, or kept growing while the broker is away
+void sampleGroup(ReqTypes r, const int16_t *values)
+{
+  if (!(sampledGroups & (1UL << r)))
+  {
+    sampledGroups |= 1UL << r;
+    publishGroup(r, values);
+  }
+  uint64_t now = clockMillis();
+  if (aggregateCount(r) != 0 && now - aggregateStart(r) >= (uint64_t)scheduleGetPeriod(r) * 1000 && mqttClient.connected())
+  {
+    publishAggregate(r);
+    aggregateReset(r);
+  }
+  aggregateAdd(r, values, now);
+}
+
+// A group read by the poll cycle, already in the snapshot cache
+void pollRead(int r, const int16_t *values)
+{
+  historyAdd(r, values, clockSeconds());
+  bootSaveGroup(r, values);
+  bootMark(BOOT_READ);
+  if (aggregateGroup(r) && scheduleGetPeriod(r) > 0 && !(scheduleLiveGroups() & (1UL << r)))
+  {
+    sampleGroup((ReqTypes)r, values);
+  }
+  else
+  {
+    publishGroup((ReqTypes)r, values);
+  }
+}
+
+void pollError(uint32_t groups)
+{
+  (void)groups;
+  publishModbusError(1); // error when connecting through modbus
+}
+
+// Cycle complete. In steady state nothing on the poll path allocates, so this should stay 0
+void pollFinish()
+{
+  bootFlush();
+  pollHeapDelta = (long)ESP.getFreeHeap() - pollHeap;
+}
+
+// Send one group read while the broker was away, oldest first. Runs every OUTBOX_DRAIN_INTERVAL so a
+// reconnect doesn't flood loop()
+void drainOutbox()
+{
+  int r = mqttClient.connected() ? outboxNext() : -1;
+  if (r < 0)
+  {
+    return;
+  }
+  publishAge = clockSeconds() - outboxTime(r);
+  publishGroup((ReqTypes)r, snapshotValues(r));
+  publishAge = -1;
+}
+
+// Telemetry, every MQTT_REFRESH_INTERVAL and after a connect
+void refreshTelemetry()
+{
+  if (!mqttClient.connected())
+  {
+    return;
+  }
+  profileBegin(PHASE_PUBLISH);
+  // Publish every value again on its next read, changed or not
+  char number[12];
+  memset(publishedValid, 0, sizeof(publishedValid));
+  modbusErrorPublished = -1;
+  mqttClient.publish("ventilation/gateway/suppressed", ultoa(publishSuppressed, number, 10));
+  publishHeap();
+  publishTraffic();
+  publishModbusStats();
+  publishScanTime();
+  profileEnd(PHASE_PUBLISH);
+}
+
+// Polling goes on without the broker, for HTTP, Modbus TCP and the history
+void pollCheck()
+{
+  profileBegin(PHASE_POLL);
+  uint32_t groupMask = !pollRunning() ? scheduleDue(clockMillis()) : 0;
+  if (livePublished != scheduleLiveGroups())
+  {
+    publishLive(); // Live mode ran out
+  }
+  if (groupMask != 0)
+  {
+    // Start a poll cycle with the groups that are due. The reads complete over the following loop() passes
+    pollHeap = ESP.getFreeHeap();
+    pollStart(groupMask);
+  }
+  profileEnd(PHASE_POLL);
+}
+
+void loop()
+{
+  profileBegin(PHASE_LOOP);
+  profileBegin(PHASE_OTA);
+  ArduinoOTA.handle();
+  profileEnd(PHASE_OTA);
+  profileBegin(PHASE_HTTP);
+  httpLoop();
+  profileEnd(PHASE_HTTP);
+  profileBegin(PHASE_TCP);
+  modbusTcpLoop();
+  profileEnd(PHASE_TCP);
+
+  profileBegin(PHASE_MODBUS);
+  commandLoop();
+  modbusLoop();
+  profileEnd(PHASE_MODBUS);
+
+  profileBegin(PHASE_MQTT);
+  connectionLoop();
+  profileEnd(PHASE_MQTT);
+
+  // Everything periodic, see the timerAdd() calls in setup()
+  timerLoop();
+  profileEnd(PHASE_LOOP);
+}
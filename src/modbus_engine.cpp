@@ -0,0 +1,367 @@
+#include "modbus_engine.h"
+#include "timebase.h"
+
+enum ModbusState
+{
+  modbusStateIdle = 0,
+  modbusStateWaiting
+};
+
+static Stream *modbusPort = NULL;
+static ModbusReopen modbusReopen = NULL;
+static uint8_t modbusSlave = 0;
+static ModbusState modbusState = modbusStateIdle;
+
+static ModbusTransaction modbusQueue[MODBUS_QUEUE_SIZE];
+static uint8_t modbusQueueHead = 0;
+static uint8_t modbusQueueCount = 0;
+
+static ModbusTransaction modbusCurrent;
+static unsigned long modbusStarted = 0; // millis() when the current/last request was sent
+// clockMillis() when the next transaction may start, after the gap or backoff. A deadline checked by modbusLoop()
+// rather than a timer job: it is part of the engine's state machine, which runs on its own wherever modbusLoop() is called
+static uint64_t modbusReady = 0;
+static uint8_t modbusFrame[9 + 2 * MODBUS_MAX_REGISTERS]; // Large enough for a write of all registers
+static uint16_t modbusFrameLength = 0;
+static int modbusErrors = 0; // Consecutive bus failures
+static unsigned long modbusFailingSince = 0;
+static bool modbusEverWorked = false;
+static uint16_t modbusGap = MODBUS_GAP_MAX;
+static uint32_t modbusTurnaround8 = 0;   // Average turnaround * 8
+static unsigned long modbusBackoff = 0;
+static ModbusStats modbusStatistics;
+static const uint16_t modbusLatencyBounds[MODBUS_LATENCY_BUCKETS] = MODBUS_LATENCY_BOUNDS;
+
+static uint16_t modbusCrc(const uint8_t *data, uint16_t length)
+{
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+void modbusBegin(Stream &port, uint8_t slaveAddress, ModbusReopen reopen)
+{
+  modbusPort = &port;
+  modbusReopen = reopen;
+  modbusSlave = slaveAddress;
+  modbusState = modbusStateIdle;
+  modbusQueueHead = 0;
+  modbusQueueCount = 0;
+  modbusStatistics.gap = modbusGap;
+}
+
+bool modbusSubmit(const ModbusTransaction &transaction)
+{
+  if (modbusQueueCount >= MODBUS_QUEUE_SIZE || transaction.count == 0 || transaction.count > MODBUS_MAX_REGISTERS)
+  {
+    return false;
+  }
+  // Priority transactions are kept in submission order in front of the others
+  uint8_t position = modbusQueueCount;
+  if (transaction.priority)
+  {
+    while (position > 0 && !modbusQueue[(modbusQueueHead + position - 1) % MODBUS_QUEUE_SIZE].priority)
+    {
+      modbusQueue[(modbusQueueHead + position) % MODBUS_QUEUE_SIZE] = modbusQueue[(modbusQueueHead + position - 1) % MODBUS_QUEUE_SIZE];
+      position--;
+    }
+  }
+  modbusQueue[(modbusQueueHead + position) % MODBUS_QUEUE_SIZE] = transaction;
+  modbusQueueCount++;
+  if (modbusQueueCount > modbusStatistics.queuePeak)
+  {
+    modbusStatistics.queuePeak = modbusQueueCount;
+  }
+  return true;
+}
+
+bool modbusRead(uint16_t address, uint8_t count, int16_t *values, int type, ModbusCallback callback, void *context)
+{
+  ModbusTransaction t = {};
+  // Make sure type is either 0 or 1
+  t.function = (type & 1) ? MODBUS_READ_HOLDING : MODBUS_READ_INPUT;
+  t.address = address;
+  t.count = count;
+  t.values = values;
+  t.callback = callback;
+  t.context = context;
+  return modbusSubmit(t);
+}
+
+bool modbusWrite(uint16_t address, int16_t value, ModbusCallback callback, void *context)
+{
+  ModbusTransaction t = {};
+  t.function = MODBUS_WRITE_MULTIPLE;
+  t.address = address;
+  t.count = 1;
+  t.value = value;
+  t.callback = callback;
+  t.context = context;
+  t.priority = true;
+  return modbusSubmit(t);
+}
+
+static void modbusDrain()
+{
+  while (modbusPort->available() > 0)
+  {
+    modbusPort->read();
+  }
+}
+
+static void modbusSend()
+{
+  ModbusTransaction &t = modbusCurrent;
+  const int16_t *source = t.values != NULL ? t.values : &t.value;
+  uint16_t n = 0;
+  modbusFrame[n++] = modbusSlave;
+  modbusFrame[n++] = t.function;
+  modbusFrame[n++] = t.address >> 8;
+  modbusFrame[n++] = t.address & 0xFF;
+  switch (t.function)
+  {
+  case MODBUS_WRITE_SINGLE:
+    modbusFrame[n++] = (uint16_t)source[0] >> 8;
+    modbusFrame[n++] = source[0] & 0xFF;
+    break;
+  case MODBUS_WRITE_MULTIPLE:
+    modbusFrame[n++] = 0;
+    modbusFrame[n++] = t.count;
+    modbusFrame[n++] = t.count * 2;
+    for (uint8_t i = 0; i < t.count; i++)
+    {
+      modbusFrame[n++] = (uint16_t)source[i] >> 8;
+      modbusFrame[n++] = source[i] & 0xFF;
+    }
+    break;
+  default: // Reads
+    modbusFrame[n++] = 0;
+    modbusFrame[n++] = t.count;
+  }
+  uint16_t crc = modbusCrc(modbusFrame, n);
+  modbusFrame[n++] = crc & 0xFF;
+  modbusFrame[n++] = crc >> 8;
+
+  // Drop anything left on the line from an earlier, failed transaction
+  modbusDrain();
+  modbusPort->write(modbusFrame, n);
+  modbusStatistics.bytesSent += n;
+  modbusFrameLength = 0;
+  modbusStarted = millis();
+  modbusState = modbusStateWaiting;
+}
+
+// Number of bytes the response will have, or 0 if not enough has been received to know yet
+static uint16_t modbusExpectedLength()
+{
+  if (modbusFrameLength < 2)
+  {
+    return 0;
+  }
+  if (modbusFrame[1] & 0x80)
+  {
+    return 5; // Exception response
+  }
+  switch (modbusFrame[1])
+  {
+  case MODBUS_READ_HOLDING:
+  case MODBUS_READ_INPUT:
+    return modbusFrameLength < 3 ? 0 : 5 + modbusFrame[2];
+  default:
+    return 8;
+  }
+}
+
+static uint8_t modbusParse()
+{
+  ModbusTransaction &t = modbusCurrent;
+  uint16_t length = modbusFrameLength;
+  if (modbusFrame[0] != modbusSlave)
+  {
+    return MODBUS_INVALID_SLAVE_ID;
+  }
+  uint16_t crc = modbusCrc(modbusFrame, length - 2);
+  if (modbusFrame[length - 2] != (crc & 0xFF) || modbusFrame[length - 1] != (crc >> 8))
+  {
+    return MODBUS_INVALID_CRC;
+  }
+  if ((modbusFrame[1] & 0x7F) != t.function)
+  {
+    return MODBUS_INVALID_FUNCTION;
+  }
+  if (modbusFrame[1] & 0x80)
+  {
+    return modbusFrame[2];
+  }
+  if (t.function == MODBUS_READ_HOLDING || t.function == MODBUS_READ_INPUT)
+  {
+    if (modbusFrame[2] != t.count * 2)
+    {
+      return MODBUS_INVALID_FUNCTION;
+    }
+    for (uint8_t i = 0; i < t.count; i++)
+    {
+      t.values[i] = (int16_t)((modbusFrame[3 + 2 * i] << 8) | modbusFrame[4 + 2 * i]);
+    }
+  }
+  return MODBUS_SUCCESS;
+}
+
+static void modbusCount(uint8_t result)
+{
+  uint8_t function = modbusCurrent.function;
+  ModbusFunctionStats &stats = modbusStatistics.function[function == MODBUS_READ_INPUT ? 0 : function == MODBUS_READ_HOLDING ? 1 : 2];
+  switch (result)
+  {
+  case MODBUS_SUCCESS:
+    stats.success++;
+    break;
+  case MODBUS_RESPONSE_TIMEOUT:
+    stats.timeout++;
+    break;
+  case MODBUS_INVALID_CRC:
+    stats.crc++;
+    break;
+  case MODBUS_ILLEGAL_FUNCTION:
+  case MODBUS_ILLEGAL_DATA_ADDRESS:
+  case MODBUS_ILLEGAL_DATA_VALUE:
+  case MODBUS_SLAVE_DEVICE_FAILURE:
+    stats.exception[result - 1]++;
+    break;
+  default:
+    stats.invalid++;
+  }
+  unsigned long latency = millis() - modbusStarted;
+  uint8_t bucket = 0;
+  while (bucket < MODBUS_LATENCY_BUCKETS - 1 && latency > modbusLatencyBounds[bucket])
+  {
+    bucket++;
+  }
+  stats.latency[bucket]++;
+  stats.latencySum += latency;
+}
+
+// Adapt the pacing to the result and take the recovery steps for a failing bus
+static void modbusPace(uint8_t result)
+{
+  bool failed = result > MODBUS_SLAVE_DEVICE_FAILURE;
+  if (!failed)
+  {
+    modbusErrors = 0;
+    modbusBackoff = 0;
+    modbusEverWorked = true;
+    uint32_t target = modbusTurnaround8 / 8 * MODBUS_GAP_TURNAROUND;
+    target = target < MODBUS_GAP_MIN ? MODBUS_GAP_MIN : target > MODBUS_GAP_MAX ? MODBUS_GAP_MAX : target;
+    modbusGap = modbusGap <= target ? target : modbusGap - ((modbusGap - target + 7) / 8);
+  }
+  else
+  {
+    modbusGap = modbusGap * 2 < MODBUS_GAP_MAX ? modbusGap * 2 : MODBUS_GAP_MAX;
+    modbusBackoff = modbusBackoff == 0 ? MODBUS_BACKOFF_MIN : modbusBackoff * 2 < MODBUS_BACKOFF_MAX ? modbusBackoff * 2 : MODBUS_BACKOFF_MAX;
+    if (modbusErrors++ == 0)
+    {
+      modbusFailingSince = millis();
+    }
+    // Resync: forget the rest of a broken answer, the backoff gives the line time to go quiet
+    modbusDrain();
+    if (modbusErrors % MODBUS_RECOVER_REOPEN == 0 && modbusReopen != NULL)
+    {
+      modbusReopen();
+      modbusStatistics.reopens++;
+    }
+    // A reboot only helps when something on our side is stuck. A bus that never worked won't work after it either
+    if (modbusEverWorked && millis() - modbusFailingSince > MODBUS_REBOOT_AFTER)
+    {
+      ESP.restart();
+    }
+  }
+  modbusStatistics.consecutiveErrors = modbusErrors;
+  modbusStatistics.gap = modbusGap;
+  modbusStatistics.backoff = modbusBackoff;
+}
+
+// Pause before the next transaction may start
+static unsigned long modbusPause()
+{
+  return modbusBackoff != 0 ? modbusBackoff : modbusGap;
+}
+
+static void modbusFinish(uint8_t result)
+{
+  modbusState = modbusStateIdle;
+  modbusCurrent.result = result;
+  modbusCount(result);
+  modbusPace(result);
+  modbusReady = clockMillis() + modbusPause();
+  if (modbusCurrent.callback != NULL)
+  {
+    // The callback is free to submit new transactions
+    modbusCurrent.callback(modbusCurrent);
+  }
+}
+
+void modbusLoop()
+{
+  if (modbusPort == NULL)
+  {
+    return;
+  }
+  if (modbusState == modbusStateIdle)
+  {
+    if (modbusQueueCount == 0 || clockMillis() < modbusReady)
+    {
+      return;
+    }
+    modbusCurrent = modbusQueue[modbusQueueHead];
+    modbusQueueHead = (modbusQueueHead + 1) % MODBUS_QUEUE_SIZE;
+    modbusQueueCount--;
+    modbusSend();
+    return;
+  }
+
+  // Waiting for the response. Take whatever has arrived and never block for more
+  if (modbusFrameLength == 0 && modbusPort->available() > 0)
+  {
+    uint32_t turnaround = millis() - modbusStarted;
+    modbusTurnaround8 = modbusTurnaround8 == 0 ? turnaround * 8 : modbusTurnaround8 + turnaround - modbusTurnaround8 / 8;
+    modbusStatistics.turnaround = modbusTurnaround8 / 8;
+  }
+  while (modbusPort->available() > 0 && modbusFrameLength < sizeof(modbusFrame))
+  {
+    modbusFrame[modbusFrameLength++] = modbusPort->read();
+    modbusStatistics.bytesReceived++;
+  }
+  uint16_t expected = modbusExpectedLength();
+  if (expected > 0 && modbusFrameLength >= expected)
+  {
+    modbusFrameLength = expected;
+    modbusFinish(modbusParse());
+  }
+  else if (millis() - modbusStarted > MODBUS_RESPONSE_TIMEOUT_MS)
+  {
+    modbusFinish(MODBUS_RESPONSE_TIMEOUT);
+  }
+}
+
+const ModbusStats &modbusStats()
+{
+  return modbusStatistics;
+}
+
+const char *modbusFunctionName(uint8_t index)
+{
+  static const char *const names[MODBUS_STAT_FUNCTIONS] = {"readInput", "readHolding", "write"};
+  return names[index];
+}
+
+uint16_t modbusLatencyBound(uint8_t bucket)
+{
+  return modbusLatencyBounds[bucket];
+}
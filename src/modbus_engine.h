@@ -0,0 +1,98 @@
+/*
+ *  Non-blocking Modbus RTU master.
+ *  Transactions are queued with modbusSubmit() and advanced a little on every call to modbusLoop(),
+ *  so the main loop never waits for the bus. The result is handed to a completion callback.
+ */
+#pragma once
+#include <Arduino.h>
+
+// Result codes. Same values as the ModbusMaster library so existing status reporting is unchanged
+#define MODBUS_SUCCESS 0x00
+#define MODBUS_ILLEGAL_FUNCTION 0x01
+#define MODBUS_ILLEGAL_DATA_ADDRESS 0x02
+#define MODBUS_ILLEGAL_DATA_VALUE 0x03
+#define MODBUS_SLAVE_DEVICE_FAILURE 0x04
+#define MODBUS_INVALID_SLAVE_ID 0xE0
+#define MODBUS_INVALID_FUNCTION 0xE1
+#define MODBUS_RESPONSE_TIMEOUT 0xE2
+#define MODBUS_INVALID_CRC 0xE3
+
+// Function codes supported by the CTS602 controller
+#define MODBUS_READ_HOLDING 0x03
+#define MODBUS_READ_INPUT 0x04
+#define MODBUS_WRITE_SINGLE 0x06
+#define MODBUS_WRITE_MULTIPLE 0x10
+
+#define MODBUS_MAX_REGISTERS 125 // Protocol limit for a single read
+#define MODBUS_QUEUE_SIZE 8      // Pending transactions
+#define MODBUS_RESPONSE_TIMEOUT_MS 2000
+
+// Pacing. The pause between the end of one transaction and the start of the next adapts to the controller:
+// it starts at MODBUS_GAP_MAX, moves an eighth of the way towards MODBUS_GAP_TURNAROUND times the average
+// time the controller takes to answer with every good transaction, and is doubled by every failure
+#define MODBUS_GAP_MIN 20  // Milliseconds
+#define MODBUS_GAP_MAX 200 // Milliseconds
+#define MODBUS_GAP_TURNAROUND 2
+
+// Recovery. Timeouts, CRC errors and garbled answers are bus failures, exceptions are valid answers.
+// After a failure the bus is left silent for MODBUS_BACKOFF_MIN, doubled for every further failure in a row
+#define MODBUS_BACKOFF_MIN 500    // Milliseconds
+#define MODBUS_BACKOFF_MAX 60000  // Milliseconds
+#define MODBUS_RECOVER_REOPEN 5   // Failures in a row before the serial port is reopened, and again every this many
+#define MODBUS_REBOOT_AFTER 1800000 // Reboot when the bus has worked since boot but failed for this long. 30 minutes
+
+// Telemetry, kept per function: read input, read holding and write
+#define MODBUS_STAT_FUNCTIONS 3
+#define MODBUS_LATENCY_BUCKETS 8 // Upper bounds in milliseconds, the last bucket takes the rest
+#define MODBUS_LATENCY_BOUNDS {10, 20, 50, 100, 200, 500, 1000, 0}
+
+struct ModbusFunctionStats
+{
+  uint32_t success;
+  uint32_t timeout;
+  uint32_t crc;
+  uint32_t exception[4];  // Exception codes 1-4 from the controller
+  uint32_t invalid;       // Wrong slave id, function or length in the response
+  uint32_t latency[MODBUS_LATENCY_BUCKETS]; // Time from request sent to response parsed or timed out
+  uint32_t latencySum;                      // Milliseconds
+};
+
+struct ModbusStats
+{
+  ModbusFunctionStats function[MODBUS_STAT_FUNCTIONS];
+  uint32_t bytesSent;
+  uint32_t bytesReceived;
+  uint16_t consecutiveErrors; // Bus failures in a row
+  uint8_t queuePeak;          // Most transactions waiting at once
+  uint16_t gap;               // Current pause between transactions, milliseconds
+  uint16_t turnaround;        // Average time from request sent to first byte of the answer, milliseconds
+  uint32_t backoff;           // Current pause after a failure, milliseconds, 0 when the bus is healthy
+  uint32_t reopens;           // Times the serial port was reopened to recover the bus
+};
+
+struct ModbusTransaction;
+typedef void (*ModbusCallback)(ModbusTransaction &transaction);
+
+struct ModbusTransaction
+{
+  uint8_t function;
+  uint16_t address;
+  uint8_t count;
+  int16_t *values;         // Read destination or write source. Must stay valid until the callback is called
+  int16_t value;           // Write source when values is NULL
+  ModbusCallback callback; // Optional, called once the transaction is done
+  void *context;           // Passed back untouched to the callback
+  uint8_t result;          // One of the MODBUS_ result codes, set before the callback is called
+  bool priority;           // Goes ahead of the queued transactions without priority, e.g. commands before polling
+};
+
+typedef void (*ModbusReopen)(); // Ends and begins the serial port again
+
+void modbusBegin(Stream &port, uint8_t slaveAddress, ModbusReopen reopen = NULL);
+void modbusLoop();
+bool modbusSubmit(const ModbusTransaction &transaction);
+bool modbusRead(uint16_t address, uint8_t count, int16_t *values, int type, ModbusCallback callback, void *context);
+bool modbusWrite(uint16_t address, int16_t value, ModbusCallback callback, void *context); // With priority
+const ModbusStats &modbusStats();
+const char *modbusFunctionName(uint8_t index); // Of ModbusStats.function[index]
+uint16_t modbusLatencyBound(uint8_t bucket);    // Upper bound in milliseconds, 0 for the last bucket
@@ -0,0 +1,324 @@
+#include "modbus_tcp.h"
+#include "modbus_engine.h"
+#include "register_map.h"
+#include "snapshot.h"
+#include "timebase.h"
+
+#define MODBUS_TCP_HEADER 7
+
+enum ModbusTcpState
+{
+  modbusTcpStateFree,
+  modbusTcpStateReading, // Waiting for a complete request
+  modbusTcpStateQueued,  // Waiting for its turn on the bus
+  modbusTcpStateBusy,    // Transaction in progress
+  modbusTcpStateOrphaned // Client gone during a transaction, the slot stays taken until the engine is done with values
+};
+
+struct ModbusTcpConnection
+{
+  WiFiClient client;
+  uint8_t state;
+  unsigned long lastActivity;
+  uint8_t frame[MODBUS_TCP_FRAME_SIZE];
+  uint16_t length;
+  int16_t values[MODBUS_MAX_REGISTERS];
+};
+
+static WiFiServer *modbusTcpServer = NULL;
+static ModbusTcpConnection modbusTcpConnections[MODBUS_TCP_MAX_CLIENTS];
+static unsigned long modbusTcpCacheMaxAge = 0;
+static uint8_t modbusTcpTurn = 0;     // Connection that gets the bus next, if it has a request
+static bool modbusTcpOnBus = false;   // One transaction of the server in the engine at a time
+
+void modbusTcpBegin(uint16_t port, unsigned long cacheMaxAge)
+{
+  static WiFiServer server(port);
+  modbusTcpServer = &server;
+  modbusTcpCacheMaxAge = cacheMaxAge;
+  modbusTcpServer->begin();
+}
+
+static void modbusTcpClose(ModbusTcpConnection &connection)
+{
+  connection.client.stop();
+  connection.state = connection.state == modbusTcpStateBusy ? modbusTcpStateOrphaned : modbusTcpStateFree;
+}
+
+static void modbusTcpAccept()
+{
+  for (uint8_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++)
+  {
+    ModbusTcpConnection &connection = modbusTcpConnections[i];
+    if (connection.state != modbusTcpStateFree)
+    {
+      continue;
+    }
+    WiFiClient client = modbusTcpServer->available();
+    if (!client)
+    {
+      return;
+    }
+    connection.client = client;
+    connection.state = modbusTcpStateReading;
+    connection.lastActivity = millis();
+    connection.length = 0;
+  }
+}
+
+static uint16_t modbusTcpWord(const uint8_t *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+// Send the response PDU of length bytes that follows the header in frame
+static void modbusTcpSend(ModbusTcpConnection &connection, uint16_t length)
+{
+  uint8_t *frame = connection.frame;
+  frame[4] = (length + 1) >> 8; // The length counts the unit id too
+  frame[5] = (length + 1) & 0xFF;
+  connection.client.write(frame, MODBUS_TCP_HEADER + length);
+  connection.length = 0;
+  connection.state = modbusTcpStateReading;
+}
+
+static void modbusTcpException(ModbusTcpConnection &connection, uint8_t code)
+{
+  uint8_t *pdu = connection.frame + MODBUS_TCP_HEADER;
+  pdu[0] |= 0x80;
+  pdu[1] = code;
+  modbusTcpSend(connection, 2);
+}
+
+static void modbusTcpReadResponse(ModbusTcpConnection &connection, const int16_t *values, uint8_t count)
+{
+  uint8_t *pdu = connection.frame + MODBUS_TCP_HEADER;
+  pdu[1] = count * 2;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    pdu[2 + 2 * i] = (uint16_t)values[i] >> 8;
+    pdu[3 + 2 * i] = values[i] & 0xFF;
+  }
+  modbusTcpSend(connection, 2 + count * 2);
+}
+
+// Group of the given register type holding the address, -1 when none does
+static int modbusTcpGroup(uint8_t kind, uint16_t address)
+{
+  for (int g = 0; g < reqmax; g++)
+  {
+    GroupDesc group = getGroup(g);
+    if (group.kind == kind && address >= group.address && address < group.address + group.count)
+    {
+      return g;
+    }
+  }
+  return -1;
+}
+
+// Values of a read from the snapshot cache. False when any of the registers is not cached or too old
+static bool modbusTcpCached(uint8_t kind, uint16_t address, uint8_t count, int16_t *values)
+{
+  uint64_t now = clockMillis();
+  for (uint8_t i = 0; i < count; i++)
+  {
+    int g = modbusTcpGroup(kind, address + i);
+    if (g < 0 || !snapshotValid(g) || now - snapshotTime(g) > modbusTcpCacheMaxAge)
+    {
+      return false;
+    }
+    values[i] = snapshotValues(g)[address + i - getGroup(g).address];
+  }
+  return true;
+}
+
+// Keep the cache in line with what a client wrote
+static void modbusTcpWritten(uint16_t address, const int16_t *values, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    int g = modbusTcpGroup(HOLDING_REGISTER, address + i);
+    if (g >= 0)
+    {
+      snapshotUpdate(g, address + i - getGroup(g).address, values[i]);
+    }
+  }
+}
+
+static void modbusTcpDone(ModbusTransaction &transaction)
+{
+  ModbusTcpConnection &connection = *(ModbusTcpConnection *)transaction.context;
+  modbusTcpOnBus = false;
+  if (connection.state == modbusTcpStateOrphaned)
+  {
+    connection.state = modbusTcpStateFree; // The client went away meanwhile
+    return;
+  }
+  if (transaction.result > MODBUS_SLAVE_DEVICE_FAILURE)
+  {
+    modbusTcpException(connection, MODBUS_GATEWAY_TARGET_FAILED);
+  }
+  else if (transaction.result != MODBUS_SUCCESS)
+  {
+    modbusTcpException(connection, transaction.result);
+  }
+  else if (transaction.function == MODBUS_READ_INPUT || transaction.function == MODBUS_READ_HOLDING)
+  {
+    modbusTcpReadResponse(connection, transaction.values, transaction.count);
+  }
+  else
+  {
+    modbusTcpWritten(transaction.address, transaction.values, transaction.count);
+    modbusTcpSend(connection, 5); // Echo of function, address and value or count
+  }
+}
+
+// Check the request in the frame and answer it, from the cache or with an error, when no bus transaction is needed.
+// Returns false when it has to go on the bus
+static bool modbusTcpAnswer(ModbusTcpConnection &connection)
+{
+  uint8_t *pdu = connection.frame + MODBUS_TCP_HEADER;
+  uint16_t length = connection.length - MODBUS_TCP_HEADER;
+  uint16_t address = modbusTcpWord(pdu + 1);
+  uint16_t count = modbusTcpWord(pdu + 3);
+  switch (pdu[0])
+  {
+  case MODBUS_READ_HOLDING:
+  case MODBUS_READ_INPUT:
+    if (length != 5 || count == 0 || count > MODBUS_MAX_REGISTERS)
+    {
+      modbusTcpException(connection, MODBUS_ILLEGAL_DATA_VALUE);
+      return true;
+    }
+    if (modbusTcpCached(pdu[0] == MODBUS_READ_HOLDING ? HOLDING_REGISTER : INPUT_REGISTER, address, count, connection.values))
+    {
+      modbusTcpReadResponse(connection, connection.values, count);
+      return true;
+    }
+    return false;
+  case MODBUS_WRITE_SINGLE:
+    if (length != 5)
+    {
+      modbusTcpException(connection, MODBUS_ILLEGAL_DATA_VALUE);
+      return true;
+    }
+    return false;
+  case MODBUS_WRITE_MULTIPLE:
+    if (count == 0 || count > 123 || length < 6 || pdu[5] != count * 2 || length != 6 + count * 2)
+    {
+      modbusTcpException(connection, MODBUS_ILLEGAL_DATA_VALUE);
+      return true;
+    }
+    return false;
+  default:
+    modbusTcpException(connection, MODBUS_ILLEGAL_FUNCTION);
+    return true;
+  }
+}
+
+// Hand the request of the connection to the Modbus engine. False when the engine queue is full
+static bool modbusTcpSubmit(ModbusTcpConnection &connection)
+{
+  const uint8_t *pdu = connection.frame + MODBUS_TCP_HEADER;
+  ModbusTransaction t = {};
+  t.function = pdu[0];
+  t.address = modbusTcpWord(pdu + 1);
+  t.count = pdu[0] == MODBUS_WRITE_SINGLE ? 1 : modbusTcpWord(pdu + 3);
+  t.values = connection.values;
+  t.callback = modbusTcpDone;
+  t.context = &connection;
+  if (pdu[0] == MODBUS_WRITE_SINGLE)
+  {
+    connection.values[0] = modbusTcpWord(pdu + 3);
+  }
+  else if (pdu[0] == MODBUS_WRITE_MULTIPLE)
+  {
+    for (uint8_t i = 0; i < t.count; i++)
+    {
+      connection.values[i] = modbusTcpWord(pdu + 6 + 2 * i);
+    }
+  }
+  t.priority = pdu[0] == MODBUS_WRITE_SINGLE || pdu[0] == MODBUS_WRITE_MULTIPLE;
+  return modbusSubmit(t);
+}
+
+// Read what has arrived of the next request. Returns true once it is complete
+static bool modbusTcpRead(ModbusTcpConnection &connection)
+{
+  while (connection.client.available() > 0)
+  {
+    uint16_t expected = connection.length < MODBUS_TCP_HEADER ? MODBUS_TCP_HEADER : 6 + modbusTcpWord(connection.frame + 4);
+    if (connection.length >= expected)
+    {
+      break;
+    }
+    connection.frame[connection.length++] = connection.client.read();
+    if (connection.length == MODBUS_TCP_HEADER)
+    {
+      uint16_t length = modbusTcpWord(connection.frame + 4);
+      if (modbusTcpWord(connection.frame + 2) != 0 || length < 2 || 6 + length > MODBUS_TCP_FRAME_SIZE)
+      {
+        modbusTcpClose(connection); // Not Modbus, or out of step with the client
+        return false;
+      }
+    }
+  }
+  return connection.length > MODBUS_TCP_HEADER && connection.length == 6 + modbusTcpWord(connection.frame + 4);
+}
+
+void modbusTcpLoop()
+{
+  if (modbusTcpServer == NULL)
+  {
+    return;
+  }
+  modbusTcpAccept();
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++)
+  {
+    ModbusTcpConnection &connection = modbusTcpConnections[i];
+    if (connection.state == modbusTcpStateFree || connection.state == modbusTcpStateOrphaned)
+    {
+      continue;
+    }
+    if (!connection.client.connected())
+    {
+      // A transaction in progress still uses values, the slot is freed by its callback
+      modbusTcpClose(connection);
+      continue;
+    }
+    if (connection.state == modbusTcpStateReading)
+    {
+      if (modbusTcpRead(connection))
+      {
+        connection.lastActivity = now;
+        if (!modbusTcpAnswer(connection))
+        {
+          connection.state = modbusTcpStateQueued;
+        }
+      }
+      else if (connection.state == modbusTcpStateReading && now - connection.lastActivity > MODBUS_TCP_IDLE_TIMEOUT)
+      {
+        modbusTcpClose(connection);
+      }
+    }
+  }
+
+  // Round robin over the connections with a request waiting
+  for (uint8_t n = 0; n < MODBUS_TCP_MAX_CLIENTS && !modbusTcpOnBus; n++)
+  {
+    uint8_t i = (modbusTcpTurn + n) % MODBUS_TCP_MAX_CLIENTS;
+    ModbusTcpConnection &connection = modbusTcpConnections[i];
+    if (connection.state != modbusTcpStateQueued)
+    {
+      continue;
+    }
+    if (!modbusTcpSubmit(connection))
+    {
+      break; // Engine queue full, same connection tries again next time
+    }
+    connection.state = modbusTcpStateBusy;
+    modbusTcpOnBus = true;
+    modbusTcpTurn = (i + 1) % MODBUS_TCP_MAX_CLIENTS;
+  }
+}
@@ -0,0 +1,21 @@
+/*
+ *  Modbus TCP server.
+ *  Lets other systems read and write the registers of the CTS602 with function codes 3, 4, 6 and 16. All
+ *  clients share the one RTU link: every client has at most one request in progress and the clients take
+ *  turns, so a busy poller can't starve the others. Reads of registers in the snapshot cache are answered
+ *  without a bus transaction while the cache is young enough. The unit id is ignored and echoed back.
+ */
+#pragma once
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#define MODBUS_TCP_MAX_CLIENTS 4
+#define MODBUS_TCP_IDLE_TIMEOUT 60000 // Milliseconds without a request before a client is dropped
+#define MODBUS_TCP_FRAME_SIZE 260     // Largest Modbus TCP frame, 7 bytes header and 253 bytes PDU
+
+// Exception codes added by gateways
+#define MODBUS_GATEWAY_PATH_UNAVAILABLE 0x0A
+#define MODBUS_GATEWAY_TARGET_FAILED 0x0B
+
+void modbusTcpBegin(uint16_t port, unsigned long cacheMaxAge);
+void modbusTcpLoop();
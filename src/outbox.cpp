@@ -0,0 +1,52 @@
+#include "outbox.h"
+#include "register_map.h"
+
+static uint32_t outboxGroups = 0; // Groups with unsent values
+static uint32_t outboxTimes[reqmax];
+
+void outboxPut(int group, uint32_t seconds)
+{
+  if (!(outboxGroups & (1UL << group)))
+  {
+    outboxGroups |= 1UL << group;
+    outboxTimes[group] = seconds;
+  }
+}
+
+void outboxRemove(int group)
+{
+  outboxGroups &= ~(1UL << group);
+}
+
+int outboxNext()
+{
+  if (outboxGroups == 0)
+  {
+    return -1;
+  }
+  int oldest = -1;
+  for (int g = 0; g < reqmax; g++)
+  {
+    if ((outboxGroups & (1UL << g)) && (oldest < 0 || outboxTimes[g] < outboxTimes[oldest]))
+    {
+      oldest = g;
+    }
+  }
+  outboxGroups &= ~(1UL << oldest);
+  return oldest;
+}
+
+uint32_t outboxTime(int group)
+{
+  return outboxTimes[group];
+}
+
+uint8_t outboxCount()
+{
+  uint8_t n = 0;
+  for (uint32_t groups = outboxGroups; groups != 0; groups &= groups - 1)
+  {
+    n++;
+  }
+  return n;
+}
@@ -0,0 +1,18 @@
+/*
+ *  Store and forward of polled values while the broker is away.
+ *  The values themselves stay in the snapshot cache, which always holds the latest read of every group, so
+ *  the outbox only remembers which groups have news and since when. That keeps it at a few bytes per group
+ *  and repeated reads of a group during an outage end up as one message per topic. After a reconnect the
+ *  groups are handed out oldest first by a job that runs every OUTBOX_DRAIN_INTERVAL, so the backlog doesn't
+ *  crowd out loop().
+ */
+#pragma once
+#include <Arduino.h>
+
+#define OUTBOX_DRAIN_INTERVAL 200 // Milliseconds between two groups sent after a reconnect
+
+void outboxPut(int group, uint32_t seconds); // Seconds since boot of the read, the oldest one is kept
+void outboxRemove(int group);                // Published by other means meanwhile
+int outboxNext();                            // Oldest group waiting, -1 when empty
+uint32_t outboxTime(int group);              // Seconds since boot of the first unsent read of the group
+uint8_t outboxCount();
@@ -0,0 +1,109 @@
+#include "poll_cycle.h"
+#include "configuration.h"
+#include "modbus_engine.h"
+#include "poll_schedule.h"
+#include "read_planner.h"
+#include "register_map.h"
+#include "snapshot.h"
+#include "timebase.h"
+
+#if MODBUS_PLAN_MAX_FRAME > MAX_REG_SIZE
+#define POLL_BUFFER_SIZE MODBUS_PLAN_MAX_FRAME
+#else
+#define POLL_BUFFER_SIZE MAX_REG_SIZE
+#endif
+
+static int16_t pollBuffer[POLL_BUFFER_SIZE]; // Owned by the poller so HTTP requests can't overwrite it mid-transaction
+static ReadSpan pollPlan[reqmax];            // Reads of the running poll cycle
+static uint8_t pollPlanSize = 0;
+static int pollIndex = -1;                   // Position in pollPlan, -1 when no poll cycle is running
+static uint32_t pollStandaloneGroups = 0;    // Groups that failed in a merged read and are read on their own from now on
+static PollReadHandler pollRead = NULL;
+static PollErrorHandler pollError = NULL;
+static PollFinishHandler pollFinish = NULL;
+
+static void pollNext();
+
+void pollBegin(PollReadHandler read, PollErrorHandler error, PollFinishHandler finish)
+{
+  pollRead = read;
+  pollError = error;
+  pollFinish = finish;
+}
+
+// Plan and start reading the given groups
+void pollStart(uint32_t groups)
+{
+  pollPlanSize = planReads(groups, pollStandaloneGroups, MODBUS_PLAN_MAX_GAP, MODBUS_PLAN_MAX_FRAME, pollPlan, reqmax);
+  pollIndex = 0;
+  pollNext();
+}
+
+bool pollRunning()
+{
+  return pollIndex >= 0;
+}
+
+uint32_t pollStandalone()
+{
+  return pollStandaloneGroups;
+}
+
+static void pollDone(ModbusTransaction &transaction)
+{
+  const ReadSpan &span = pollPlan[pollIndex];
+  if (transaction.result == MODBUS_SUCCESS)
+  {
+    // Fan the frame back out to the groups it covers
+    for (int r = 0; r < reqmax; r++)
+    {
+      if (span.groups & (1UL << r))
+      {
+        snapshotStore(r, pollBuffer + (getGroup(r).address - span.address));
+        pollRead(r, snapshotValues(r));
+      }
+    }
+    scheduleDone(span.groups, true, clockMillis());
+  }
+  else if (transaction.result <= MODBUS_SLAVE_DEVICE_FAILURE && (span.groups & (span.groups - 1)))
+  {
+    // The controller rejected a merged read, probably because of a missing register in the hole between
+    // the groups. Read them one by one for the rest of this cycle and in all following cycles
+    uint32_t remaining = 0;
+    for (int i = pollIndex; i < pollPlanSize; i++)
+    {
+      remaining |= pollPlan[i].groups;
+    }
+    pollStandaloneGroups |= span.groups;
+    pollStart(remaining);
+    return;
+  }
+  else
+  {
+    pollError(span.groups);
+    scheduleDone(span.groups, false, clockMillis());
+  }
+  pollIndex++;
+  pollNext();
+}
+
+// Queue the next read of the poll cycle. The reads are chained through pollDone()
+// so only one poll read is in the queue at any time
+static void pollNext()
+{
+  if (pollIndex < 0 || pollIndex >= pollPlanSize)
+  {
+    if (pollIndex >= 0)
+    {
+      pollFinish();
+    }
+    pollIndex = -1;
+    return;
+  }
+  const ReadSpan &span = pollPlan[pollIndex];
+  if (!modbusRead(span.address, span.count, pollBuffer, span.type, pollDone, NULL))
+  {
+    // Queue is full, skip the rest of this cycle
+    pollIndex = -1;
+  }
+}
@@ -0,0 +1,19 @@
+/*
+ *  Poll cycle.
+ *  Reads a set of groups in the few Modbus reads the planner works out, one read in the engine queue at a time
+ *  so commands and HTTP requests get in between. A merged read is fanned back out to the groups it covers,
+ *  each one is stored in the snapshot cache and handed to the read handler. When the controller rejects a
+ *  merged read, usually for a missing register in the hole between two groups, its groups are read one by
+ *  one for the rest of the cycle and in every cycle after.
+ */
+#pragma once
+#include <Arduino.h>
+
+typedef void (*PollReadHandler)(int group, const int16_t *values); // Group read and stored in the snapshot cache
+typedef void (*PollErrorHandler)(uint32_t groups);                   // Read of these groups failed
+typedef void (*PollFinishHandler)();                                 // Every read of the cycle is done
+
+void pollBegin(PollReadHandler read, PollErrorHandler error, PollFinishHandler finish);
+void pollStart(uint32_t groups); // Starts a cycle, the reads complete over the following loop() passes
+bool pollRunning();
+uint32_t pollStandalone(); // Groups that are no longer merged with others
@@ -0,0 +1,273 @@
+#include "poll_schedule.h"
+#include <LittleFS.h>
+#include "configuration.h"
+#include "register_map.h"
+#include "timebase.h"
+
+static int32_t schedulePeriod[reqmax];    // Seconds
+static uint64_t scheduleNext[reqmax];      // clockMillis() of the next read
+static uint32_t scheduleActive = 0;        // Groups with a pending read
+static uint32_t liveGroups = 0;            // Groups in live mode, read every livePeriod instead of their period
+static unsigned long livePeriod = 0;
+static uint64_t liveUntil = 0;
+static uint32_t sampleGroups = 0; // Groups read every samplePeriod while their period is positive
+static unsigned long samplePeriod = 0;
+
+static bool scheduleReached(uint64_t now, uint64_t time)
+{
+  return now >= time;
+}
+
+// Milliseconds between reads of a group with a positive period. 64 bits, periods beyond 49 days don't fit in 32
+static uint64_t scheduleStep(int group)
+{
+  if (sampleGroups & (1UL << group))
+  {
+    return samplePeriod;
+  }
+  return (uint64_t)schedulePeriod[group] * 1000;
+}
+
+// First read of a group, somewhere within POLL_JITTER or its period if that is shorter
+static void scheduleStart(int group, uint64_t now)
+{
+  if (liveGroups & (1UL << group))
+  {
+    return; // Started again when live mode ends
+  }
+  int32_t period = schedulePeriod[group];
+  if (period == POLL_NEVER)
+  {
+    scheduleActive &= ~(1UL << group);
+    return;
+  }
+  unsigned long spread = POLL_JITTER;
+  if (period > 0 && scheduleStep(group) < spread)
+  {
+    spread = scheduleStep(group);
+  }
+  scheduleNext[group] = now + random(spread);
+  scheduleActive |= 1UL << group;
+}
+
+static void scheduleLoadDefaults()
+{
+  memset(schedulePeriod, 0, sizeof(schedulePeriod));
+#define POLL_GROUP(group, seconds) schedulePeriod[req##group] = seconds;
+  POLL_SCHEDULE
+#undef POLL_GROUP
+}
+
+static bool scheduleSave()
+{
+  StaticJsonDocument<JSON_OBJECT_SIZE(reqmax) + 256> doc; // Group names are copied
+  for (int g = 0; g < reqmax; g++)
+  {
+    doc[FPSTR(getGroup(g).name)] = schedulePeriod[g];
+  }
+  File file = LittleFS.open(POLL_SCHEDULE_FILE, "w");
+  if (!file)
+  {
+    return false;
+  }
+  serializeJson(doc, file);
+  file.close();
+  return true;
+}
+
+// Sets the periods of the listed groups without touching their timing
+static bool scheduleSet(JsonObject periods)
+{
+  bool ok = true;
+  for (JsonPair pair : periods)
+  {
+    int g = findGroup(pair.key().c_str());
+    // as<int32_t>() makes 0 of text, null or numbers out of range, which would silently stop polling the group
+    if (g < 0 || !pair.value().is<int32_t>())
+    {
+      ok = false;
+      continue;
+    }
+    int32_t period = pair.value().as<int32_t>();
+    if (period < POLL_AT_BOOT)
+    {
+      ok = false;
+      continue;
+    }
+    schedulePeriod[g] = period;
+  }
+  return ok;
+}
+
+void scheduleBegin(uint32_t bootGroups)
+{
+  scheduleLoadDefaults();
+  if (LittleFS.begin())
+  {
+    File file = LittleFS.open(POLL_SCHEDULE_FILE, "r");
+    if (file)
+    {
+      StaticJsonDocument<JSON_OBJECT_SIZE(reqmax) + 256> doc;
+      if (!deserializeJson(doc, file))
+      {
+        scheduleSet(doc.as<JsonObject>());
+      }
+      file.close();
+    }
+  }
+  uint64_t now = clockMillis();
+  for (int g = 0; g < reqmax; g++)
+  {
+    scheduleStart(g, now);
+    if (bootGroups & (1UL << g))
+    {
+      scheduleNext[g] = now;
+    }
+  }
+}
+
+// Back to the normal schedule for the groups that were live
+static void liveStop(uint64_t now)
+{
+  uint32_t groups = liveGroups;
+  liveGroups = 0;
+  for (int g = 0; g < reqmax; g++)
+  {
+    if (groups & (1UL << g))
+    {
+      scheduleStart(g, now);
+    }
+  }
+}
+
+uint32_t scheduleDue(uint64_t now)
+{
+  if (liveGroups != 0 && scheduleReached(now, liveUntil))
+  {
+    liveStop(now);
+  }
+  uint32_t due = 0;
+  for (int g = 0; g < reqmax; g++)
+  {
+    if ((scheduleActive & (1UL << g)) && scheduleReached(now, scheduleNext[g]))
+    {
+      due |= 1UL << g;
+    }
+  }
+  return due;
+}
+
+void scheduleDone(uint32_t groups, bool ok, uint64_t now)
+{
+  for (int g = 0; g < reqmax; g++)
+  {
+    if (!(groups & (1UL << g)) || !(scheduleActive & (1UL << g)))
+    {
+      continue;
+    }
+    if (liveGroups & (1UL << g))
+    {
+      scheduleNext[g] = now + livePeriod; // Reads that take longer than the period just follow each other
+      continue;
+    }
+    int32_t period = schedulePeriod[g];
+    if (period == POLL_AT_BOOT)
+    {
+      if (ok)
+      {
+        scheduleActive &= ~(1UL << g);
+      }
+      else
+      {
+        scheduleNext[g] = now + POLL_RETRY;
+      }
+      continue;
+    }
+    // Keep the phase so the spread of the first reads holds, unless the read was late by a whole period
+    scheduleNext[g] += scheduleStep(g);
+    if (scheduleReached(now, scheduleNext[g]))
+    {
+      scheduleNext[g] = now + scheduleStep(g);
+    }
+  }
+}
+
+void scheduleSample(uint32_t groups, unsigned long period)
+{
+  sampleGroups = groups;
+  samplePeriod = period;
+}
+
+void scheduleNow(uint32_t groups)
+{
+  uint64_t now = clockMillis();
+  for (int g = 0; g < reqmax; g++)
+  {
+    if ((groups & scheduleActive) & (1UL << g))
+    {
+      scheduleNext[g] = now;
+    }
+  }
+}
+
+int32_t scheduleGetPeriod(int group)
+{
+  return schedulePeriod[group];
+}
+
+bool scheduleApply(JsonObject periods)
+{
+  bool ok = scheduleSet(periods);
+  uint64_t now = clockMillis();
+  for (JsonPair pair : periods)
+  {
+    int g = findGroup(pair.key().c_str());
+    if (g >= 0)
+    {
+      scheduleStart(g, now);
+    }
+  }
+  return scheduleSave() && ok;
+}
+
+void scheduleDefaults()
+{
+  scheduleLoadDefaults();
+  LittleFS.remove(POLL_SCHEDULE_FILE);
+  uint64_t now = clockMillis();
+  for (int g = 0; g < reqmax; g++)
+  {
+    scheduleStart(g, now);
+  }
+}
+
+void scheduleLive(uint32_t groups, unsigned long period, unsigned long duration)
+{
+  uint64_t now = clockMillis();
+  liveStop(now);
+  if (groups == 0 || duration == 0)
+  {
+    return;
+  }
+  liveGroups = groups;
+  livePeriod = period;
+  liveUntil = now + duration;
+  for (int g = 0; g < reqmax; g++)
+  {
+    if (groups & (1UL << g))
+    {
+      scheduleNext[g] = now;
+      scheduleActive |= 1UL << g;
+    }
+  }
+}
+
+uint32_t scheduleLiveGroups()
+{
+  return liveGroups;
+}
+
+unsigned long scheduleLiveRemaining(uint64_t now)
+{
+  return liveGroups != 0 && !scheduleReached(now, liveUntil) ? liveUntil - now : 0;
+}
@@ -0,0 +1,36 @@
+/*
+ *  Poll schedule.
+ *  Every group has its own period. The first read of each group is shifted by a random amount, so groups
+ *  with the same period don't all hit the bus at once. Periods can be changed at runtime and are kept in
+ *  flash in /schedule.json, with the same format as the MQTT command: {"temp1":60,"app":-1}
+ */
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define POLL_NEVER 0    // Period of a group that is not polled
+#define POLL_AT_BOOT -1 // Period of a group read once after boot
+#define POLL_JITTER 30000 // Milliseconds, the first read of a group is spread over this time or its period if shorter
+#define POLL_RETRY 60000  // Milliseconds before a failed POLL_AT_BOOT group is read again
+#define POLL_CHECK_INTERVAL 20 // Milliseconds between checks for groups that are due
+#define POLL_SCHEDULE_FILE "/schedule.json"
+
+// Defaults from configuration.h, then the saved schedule. The bootGroups are read right away, the rest spread out
+void scheduleBegin(uint32_t bootGroups);
+uint32_t scheduleDue(uint64_t now);                     // Mask of the groups to read now. Times are clockMillis()
+void scheduleDone(uint32_t groups, bool ok, uint64_t now); // Groups of a finished read
+void scheduleNow(uint32_t groups);                           // Read these groups at the next opportunity, if scheduled
+int32_t scheduleGetPeriod(int group);                        // Seconds, POLL_NEVER or POLL_AT_BOOT
+// Changes the periods of the listed groups and saves the schedule. Returns false for unknown groups and
+// periods that are not whole numbers of at least POLL_AT_BOOT, those entries are skipped
+bool scheduleApply(JsonObject periods);
+void scheduleDefaults(); // Back to configuration.h and removes the saved schedule
+
+// Sampled groups are read every period milliseconds. Their own period stays the reporting interval, see aggregate.h
+void scheduleSample(uint32_t groups, unsigned long period);
+
+// Live mode: read the groups every period milliseconds for duration milliseconds, then go back to the schedule.
+// A new call replaces the running live mode, no groups or duration 0 stops it. Not saved
+void scheduleLive(uint32_t groups, unsigned long period, unsigned long duration);
+uint32_t scheduleLiveGroups();                         // 0 when live mode is off
+unsigned long scheduleLiveRemaining(uint64_t now); // Milliseconds
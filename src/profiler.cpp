@@ -0,0 +1,163 @@
+#include "profiler.h"
+
+static const uint32_t profileBounds[PROFILE_BUCKETS] = {50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 0};
+static const char *const profileNames[PHASE_COUNT] = {"loop", "ota", "http", "mqtt", "modbus", "poll", "publish", "tcp"};
+
+static PhaseStats profilePhases[PHASE_COUNT];
+
+struct ProfileFrame
+{
+  uint8_t phase;
+  unsigned long started;
+  unsigned long nested; // Time spent in phases started inside this one
+};
+
+static ProfileFrame profileStack[PROFILE_DEPTH];
+static uint8_t profileDepth = 0;
+
+void profileBegin(uint8_t phase)
+{
+  if (profileDepth >= PROFILE_DEPTH)
+  {
+    return;
+  }
+  ProfileFrame &frame = profileStack[profileDepth++];
+  frame.phase = phase;
+  frame.started = micros();
+  frame.nested = 0;
+}
+
+void profileEnd(uint8_t phase)
+{
+  if (profileDepth == 0 || profileStack[profileDepth - 1].phase != phase)
+  {
+    return; // Unbalanced, or the begin was dropped because the stack was full
+  }
+  ProfileFrame &frame = profileStack[--profileDepth];
+  unsigned long elapsed = micros() - frame.started;
+  if (profileDepth > 0)
+  {
+    profileStack[profileDepth - 1].nested += elapsed;
+  }
+  uint32_t time = phase == PHASE_LOOP ? elapsed : elapsed - frame.nested;
+  PhaseStats &stats = profilePhases[phase];
+  stats.count++;
+  stats.sum += time;
+  if (time > stats.max)
+  {
+    stats.max = time;
+  }
+  uint8_t bucket = 0;
+  while (bucket < PROFILE_BUCKETS - 1 && time > profileBounds[bucket])
+  {
+    bucket++;
+  }
+  stats.buckets[bucket]++;
+}
+
+const PhaseStats &profileStats(uint8_t phase)
+{
+  return profilePhases[phase];
+}
+
+const char *profilePhaseName(uint8_t phase)
+{
+  return profileNames[phase];
+}
+
+uint32_t profileBucketBound(uint8_t bucket)
+{
+  return profileBounds[bucket];
+}
+
+uint32_t profilePercentile(uint8_t phase, uint8_t percent)
+{
+  const PhaseStats &stats = profilePhases[phase];
+  uint64_t target = ((uint64_t)stats.count * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < PROFILE_BUCKETS; b++)
+  {
+    seen += stats.buckets[b];
+    if (seen >= target && seen > 0)
+    {
+      return profileBounds[b];
+    }
+  }
+  return 0;
+}
+
+void printSeconds(Print &out, uint64_t micros)
+{
+  char fraction[8];
+  sprintf(fraction, ".%06lu", (unsigned long)(micros % 1000000));
+  out.print((unsigned long)(micros / 1000000));
+  out.print(fraction);
+}
+
+static void printLabel(Print &out, const char *metric, const char *phase)
+{
+  out.print(metric);
+  out.print("{phase=\"");
+  out.print(phase);
+  out.print('"');
+}
+
+void profileWriteMetrics(Print &out)
+{
+  out.println("# HELP nilan_loop_phase_seconds Time spent in each phase of loop()");
+  out.println("# TYPE nilan_loop_phase_seconds histogram");
+  for (uint8_t p = 0; p < PHASE_COUNT; p++)
+  {
+    const PhaseStats &stats = profilePhases[p];
+    uint32_t cumulative = 0;
+    for (uint8_t b = 0; b < PROFILE_BUCKETS; b++)
+    {
+      cumulative += stats.buckets[b];
+      printLabel(out, "nilan_loop_phase_seconds_bucket", profileNames[p]);
+      out.print(",le=\"");
+      if (profileBounds[b] == 0)
+      {
+        out.print("+Inf");
+      }
+      else
+      {
+        printSeconds(out, profileBounds[b]);
+      }
+      out.print("\"} ");
+      out.println(cumulative);
+    }
+    printLabel(out, "nilan_loop_phase_seconds_sum", profileNames[p]);
+    out.print("} ");
+    printSeconds(out, stats.sum);
+    out.println();
+    printLabel(out, "nilan_loop_phase_seconds_count", profileNames[p]);
+    out.print("} ");
+    out.println(stats.count);
+  }
+  out.println("# HELP nilan_loop_phase_max_seconds Longest time of a phase since boot");
+  out.println("# TYPE nilan_loop_phase_max_seconds gauge");
+  for (uint8_t p = 0; p < PHASE_COUNT; p++)
+  {
+    printLabel(out, "nilan_loop_phase_max_seconds", profileNames[p]);
+    out.print("} ");
+    printSeconds(out, profilePhases[p].max);
+    out.println();
+  }
+  // Upper bound of the bucket holding the quantile, the max when it is in the last bucket
+  static const uint8_t quantiles[] = {50, 90, 99};
+  out.println("# HELP nilan_loop_phase_quantile_seconds Quantiles estimated from the histogram buckets");
+  out.println("# TYPE nilan_loop_phase_quantile_seconds gauge");
+  for (uint8_t p = 0; p < PHASE_COUNT; p++)
+  {
+    for (uint8_t q = 0; q < sizeof(quantiles); q++)
+    {
+      uint32_t bound = profilePercentile(p, quantiles[q]);
+      printLabel(out, "nilan_loop_phase_quantile_seconds", profileNames[p]);
+      out.print(",quantile=\"0.");
+      out.print(quantiles[q]);
+      out.print("\"} ");
+      printSeconds(out, bound != 0 ? bound : profilePhases[p].max);
+      out.println();
+    }
+  }
+}
@@ -0,0 +1,41 @@
+/*
+ *  Loop profiler.
+ *  Times the phases of loop() with micros() into fixed bucket histograms. A phase started while another one
+ *  runs is subtracted from it, so each phase counts its own time only. The whole loop is the exception and
+ *  counts everything.
+ */
+#pragma once
+#include <Arduino.h>
+
+enum ProfilePhase
+{
+  PHASE_LOOP = 0, // Whole loop() pass
+  PHASE_OTA,      // ArduinoOTA.handle
+  PHASE_HTTP,     // HTTP server
+  PHASE_MQTT,     // mqttClient.loop and reconnects
+  PHASE_MODBUS,   // Modbus engine, without the publishing done from its callbacks
+  PHASE_POLL,     // Poll scheduling and planning
+  PHASE_PUBLISH,  // Publishing of values read by the poller
+  PHASE_TCP,      // Modbus TCP server
+  PHASE_COUNT
+};
+
+#define PROFILE_BUCKETS 12 // The last bucket takes everything above the second to last bound
+#define PROFILE_DEPTH 4    // Nesting of phases
+
+struct PhaseStats
+{
+  uint32_t count;
+  uint64_t sum; // Microseconds
+  uint32_t max; // Microseconds
+  uint32_t buckets[PROFILE_BUCKETS];
+};
+
+void profileBegin(uint8_t phase);
+void profileEnd(uint8_t phase);
+const PhaseStats &profileStats(uint8_t phase);
+const char *profilePhaseName(uint8_t phase);
+uint32_t profileBucketBound(uint8_t bucket);             // Microseconds, 0 for the last bucket
+uint32_t profilePercentile(uint8_t phase, uint8_t percent); // Bound of the bucket holding the percentile, 0 if beyond the last bound
+void profileWriteMetrics(Print &out);                    // Prometheus text format
+void printSeconds(Print &out, uint64_t micros);          // As a decimal number of seconds
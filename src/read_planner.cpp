@@ -0,0 +1,63 @@
+#include "read_planner.h"
+#include "register_map.h"
+
+uint8_t planReads(uint32_t groupMask, uint32_t standalone, int maxGap, uint8_t maxFrame, ReadSpan *spans, uint8_t maxSpans)
+{
+  // Collect the groups to read, sorted by register type and start address (insertion sort, the list is short)
+  GroupDesc groups[reqmax];
+  uint8_t order[reqmax];
+  uint8_t n = 0;
+  for (uint8_t g = 0; g < reqmax; g++)
+  {
+    groups[g] = getGroup(g);
+    if (!(groupMask & (1UL << g)) || groups[g].count == 0)
+    {
+      continue;
+    }
+    uint8_t i = n++;
+    while (i > 0)
+    {
+      const GroupDesc &prev = groups[order[i - 1]];
+      if (prev.kind < groups[g].kind || (prev.kind == groups[g].kind && prev.address <= groups[g].address))
+      {
+        break;
+      }
+      order[i] = order[i - 1];
+      i--;
+    }
+    order[i] = g;
+  }
+
+  // Walk the sorted groups and grow the current span as long as the limits allow it
+  uint8_t count = 0;
+  ReadSpan *span = NULL;
+  for (uint8_t i = 0; i < n; i++)
+  {
+    uint8_t g = order[i];
+    uint8_t type = groups[g].kind;
+    int start = groups[g].address;
+    int end = start + groups[g].count;
+    // A negative maxGap turns merging off, adjacent and overlapping groups included
+    if (maxGap >= 0 && span != NULL && span->type == type && !(standalone & (1UL << g)) && !(standalone & span->groups))
+    {
+      int spanEnd = span->address + span->count;
+      int newEnd = end > spanEnd ? end : spanEnd;
+      if (start - spanEnd <= maxGap && newEnd - span->address <= maxFrame)
+      {
+        span->count = newEnd - span->address;
+        span->groups |= 1UL << g;
+        continue;
+      }
+    }
+    if (count >= maxSpans)
+    {
+      break;
+    }
+    span = &spans[count++];
+    span->type = type;
+    span->address = start;
+    span->count = groups[g].count;
+    span->groups = 1UL << g;
+  }
+  return count;
+}
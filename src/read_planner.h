@@ -0,0 +1,22 @@
+/*
+ *  Read planner.
+ *  Takes a set of register groups and works out the fewest contiguous Modbus reads that cover them.
+ *  Groups of the same register type are merged when the hole between them is small enough and the
+ *  resulting frame does not grow too big.
+ */
+#pragma once
+#include <Arduino.h>
+
+struct ReadSpan
+{
+  uint8_t type;     // RegisterKind
+  uint16_t address; // First register of the read
+  uint8_t count;    // Number of registers to read
+  uint32_t groups;  // Bit mask of the groups covered by this read
+};
+
+// groupMask:  groups to read, bit n is ReqTypes n
+// standalone: groups that must be read on their own, e.g. because a merged read failed before
+// maxGap:     largest hole in registers between two groups read together, -1 reads every group on its own
+// Returns the number of spans written to spans
+uint8_t planReads(uint32_t groupMask, uint32_t standalone, int maxGap, uint8_t maxFrame, ReadSpan *spans, uint8_t maxSpans);
@@ -0,0 +1,155 @@
+#include "register_map.h"
+#include "modbus_engine.h"
+
+// Names
+#define NILAN_TOPIC(id, name) static const char topicName_##id[] PROGMEM = name;
+#define NILAN_GROUP(id, kind, address, count, topic) static const char groupName_##id[] PROGMEM = #id;
+#define NILAN_REGISTER(group, offset, name, format) static const char regName_##group##_##offset[] PROGMEM = name;
+#include "register_map.def"
+
+static const char *const topicNames[topicmax] PROGMEM = {
+#define NILAN_TOPIC(id, name) topicName_##id,
+#include "register_map.def"
+};
+
+static constexpr RegisterDesc registerTable[regmax] PROGMEM = {
+#define NILAN_REGISTER(group, offset, name, format) {regName_##group##_##offset, req##group, offset, FORMAT_##format},
+#include "register_map.def"
+};
+
+struct GroupLayout
+{
+  uint16_t address;
+  uint8_t count;
+};
+
+static constexpr GroupLayout groupLayout[reqmax] = {
+#define NILAN_GROUP(id, kind, address, count, topic) {address, count},
+#include "register_map.def"
+};
+
+static constexpr uint8_t firstRegisterOf(uint8_t group)
+{
+  uint8_t i = 0;
+  while (i < regmax && registerTable[i].group < group)
+  {
+    i++;
+  }
+  return i;
+}
+
+static constexpr uint8_t registerCountOf(uint8_t group)
+{
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < regmax; i++)
+  {
+    if (registerTable[i].group == group)
+    {
+      n++;
+    }
+  }
+  return n;
+}
+
+static constexpr GroupDesc groupTable[reqmax] PROGMEM = {
+#define NILAN_GROUP(id, kind, address, count, topic) \
+  {groupName_##id, address, count, kind##_REGISTER, topic_##topic, firstRegisterOf(req##id), registerCountOf(req##id)},
+#include "register_map.def"
+};
+
+// Consistency checks of register_map.def
+static constexpr bool registersSorted()
+{
+  for (uint8_t i = 1; i < regmax; i++)
+  {
+    const RegisterDesc &a = registerTable[i - 1];
+    const RegisterDesc &b = registerTable[i];
+    if (a.group > b.group || (a.group == b.group && a.offset >= b.offset))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static constexpr bool registersInsideGroups()
+{
+  for (uint8_t i = 0; i < regmax; i++)
+  {
+    if (registerTable[i].offset >= groupLayout[registerTable[i].group].count)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static constexpr bool groupSizesValid()
+{
+  for (uint8_t g = 0; g < reqmax; g++)
+  {
+    if (groupLayout[g].count > MAX_REG_SIZE || groupLayout[g].address + groupLayout[g].count > 0x10000)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(reqmax <= 32, "Group masks are 32 bits");
+static_assert(regmax <= 255, "Register indexes are 8 bits");
+static_assert(MAX_REG_SIZE <= MODBUS_MAX_REGISTERS, "A group must fit in one Modbus read");
+static_assert(registersSorted(), "Registers must be listed by group and then by offset, without duplicates");
+static_assert(registersInsideGroups(), "Register offset outside of its group");
+static_assert(groupSizesValid(), "Group larger than MAX_REG_SIZE or beyond the register address range");
+
+GroupDesc getGroup(int group)
+{
+  GroupDesc desc;
+  memcpy_P(&desc, &groupTable[group], sizeof(desc));
+  return desc;
+}
+
+RegisterDesc getRegister(int index)
+{
+  RegisterDesc desc;
+  memcpy_P(&desc, &registerTable[index], sizeof(desc));
+  return desc;
+}
+
+const char *getTopicName(int topic)
+{
+  return (const char *)pgm_read_ptr(&topicNames[topic]);
+}
+
+int findGroup(const char *name)
+{
+  for (int g = 0; g < reqmax; g++)
+  {
+    if (strcmp_P(name, (const char *)pgm_read_ptr(&groupTable[g].name)) == 0)
+    {
+      return g;
+    }
+  }
+  return -1;
+}
+
+int findRegister(uint8_t kind, uint16_t address)
+{
+  for (int g = 0; g < reqmax; g++)
+  {
+    GroupDesc group = getGroup(g);
+    if (group.kind != kind || address < group.address || address >= group.address + group.count)
+    {
+      continue;
+    }
+    for (int i = 0; i < group.registerCount; i++)
+    {
+      if (group.address + getRegister(group.firstRegister + i).offset == address)
+      {
+        return group.firstRegister + i;
+      }
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,78 @@
+/*
+ *  Register groups and named registers of the CTS602, expanded from register_map.def.
+ *  The tables live in flash, use getGroup()/getRegister() to read an entry.
+ */
+#pragma once
+#include <Arduino.h>
+
+#define MAX_REG_SIZE 26 // Largest group
+
+enum RegisterKind
+{
+  INPUT_REGISTER = 0,
+  HOLDING_REGISTER = 1
+};
+
+enum RegisterFormat
+{
+  FORMAT_RAW = 0,
+  FORMAT_ASCII,      // 2 characters
+  FORMAT_TEMP,       // °C * 100
+  FORMAT_HUMIDITY,   // %RH * 100
+  FORMAT_SCALED,     // Other values * 100
+  FORMAT_ALARM_CODE, // Alarm list code
+  FORMAT_DOS_DATE,   // Alarm list date
+  FORMAT_DOS_TIME    // Alarm list time
+};
+
+enum Topics
+{
+#define NILAN_TOPIC(id, name) topic_##id,
+#include "register_map.def"
+  topicmax
+};
+
+enum ReqTypes
+{
+#define NILAN_GROUP(id, kind, address, count, topic) req##id,
+#include "register_map.def"
+  reqmax
+};
+
+enum RegisterIndex
+{
+#define NILAN_REGISTER(group, offset, name, format) reg_##group##_##offset,
+#include "register_map.def"
+  regmax
+};
+
+struct GroupDesc
+{
+  const char *name;      // In flash
+  uint16_t address;      // First register
+  uint8_t count;         // Registers to read
+  uint8_t kind;          // RegisterKind
+  uint8_t topic;         // Topics
+  uint8_t firstRegister; // Index of the first named register of the group
+  uint8_t registerCount; // Number of named registers in the group
+};
+
+struct RegisterDesc
+{
+  const char *name; // In flash
+  uint8_t group;    // ReqTypes
+  uint8_t offset;   // From the group address
+  uint8_t format;   // RegisterFormat
+};
+
+GroupDesc getGroup(int group);
+RegisterDesc getRegister(int index);
+const char *getTopicName(int topic); // In flash
+int findGroup(const char *name);     // Group with the given name or -1
+int findRegister(uint8_t kind, uint16_t address); // Index of the named register at this address or -1
+
+// Sum of the register counts of all groups
+constexpr uint16_t groupRegisterTotal = 0
+#define NILAN_GROUP(id, kind, address, count, topic) +count
+#include "register_map.def"
+    ;
@@ -0,0 +1,301 @@
+#ifdef NILAN_NATIVE
+#include "cts602_sim.h"
+#include "../register_map.h"
+#include "../modbus_engine.h"
+
+#define SIM_CHAR_MICROS 573 // 11 bits per character at 19200 baud
+
+static int16_t simRegisters[2][65536];
+static uint8_t simValid[2][65536 / 8];
+static uint8_t simExceptions[2][65536];
+
+static uint16_t simCrc(const uint8_t *data, uint16_t length)
+{
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+static int16_t ascii(char high, char low)
+{
+  return (int16_t)((high << 8) | low);
+}
+
+void Cts602Simulator::begin(uint8_t slave, const SimFaults &faults)
+{
+  this->slave = slave;
+  this->faults = faults;
+  // The controller serves its registers in blocks of a hundred without holes, from the start of the block
+  // to the last register it has there. Reads that merge groups across a hole in the map are fine
+  memset(simValid, 0, sizeof(simValid));
+  memset(simExceptions, 0, sizeof(simExceptions));
+  for (int g = 0; g < reqmax; g++)
+  {
+    GroupDesc group = getGroup(g);
+    for (uint16_t a = group.address - group.address % 100; a < group.address + group.count; a++)
+    {
+      simValid[group.kind][a / 8] |= 1 << (a % 8);
+    }
+  }
+  for (int g = 0; g < reqmax; g++)
+  {
+    GroupDesc group = getGroup(g);
+    for (int i = 0; i < group.registerCount; i++)
+    {
+      RegisterDesc reg = ::getRegister(group.firstRegister + i);
+      int16_t value = 0;
+      switch (reg.format)
+      {
+      case FORMAT_TEMP:
+        value = 2000;
+        break;
+      case FORMAT_HUMIDITY:
+        value = 4500;
+        break;
+      case FORMAT_ASCII:
+        value = ascii(' ', '-');
+        break;
+      default:
+        break;
+      }
+      simRegisters[group.kind][group.address + reg.offset] = value;
+    }
+  }
+  // A controller in auto mode at 21 °C on speed 2, software 2.10.0
+  setRegister(HOLDING_REGISTER, 1001, 1);
+  setRegister(HOLDING_REGISTER, 1002, 3);
+  setRegister(HOLDING_REGISTER, 1003, 2);
+  setRegister(HOLDING_REGISTER, 1004, 2100);
+  setRegister(INPUT_REGISTER, 0, 20);
+  setRegister(INPUT_REGISTER, 1, ascii(' ', '2'));
+  setRegister(INPUT_REGISTER, 2, ascii('1', '0'));
+  setRegister(INPUT_REGISTER, 3, ascii(' ', '0'));
+  // One filter alarm in the list: 2024-03-17 13:45:58
+  setRegister(INPUT_REGISTER, 400, 1);
+  setRegister(INPUT_REGISTER, 401, 19);
+  setRegister(INPUT_REGISTER, 402, (44 << 9) | (3 << 5) | 17);
+  setRegister(INPUT_REGISTER, 403, (13 << 11) | (45 << 5) | 29);
+}
+
+int16_t Cts602Simulator::getRegister(uint8_t kind, uint16_t address)
+{
+  return simRegisters[kind][address];
+}
+
+void Cts602Simulator::setRegister(uint8_t kind, uint16_t address, int16_t value)
+{
+  simRegisters[kind][address] = value;
+}
+
+void Cts602Simulator::setException(uint8_t kind, uint16_t address, uint8_t code)
+{
+  simExceptions[kind][address] = code;
+}
+
+uint8_t Cts602Simulator::injected(uint8_t kind, uint16_t address, uint16_t count)
+{
+  for (uint32_t a = address; a < (uint32_t)address + count && a <= 0xFFFF; a++)
+  {
+    if (simExceptions[kind][a] != 0)
+    {
+      return simExceptions[kind][a];
+    }
+  }
+  return 0;
+}
+
+bool Cts602Simulator::valid(uint8_t kind, uint16_t address, uint16_t count)
+{
+  for (uint32_t a = address; a < (uint32_t)address + count; a++)
+  {
+    if (a > 0xFFFF || !(simValid[kind][a / 8] & (1 << (a % 8))))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Slowly moving temperatures and humidity, so report by exception has something to report
+void Cts602Simulator::update()
+{
+  unsigned long now = millis();
+  if (lastUpdate != 0 && now - lastUpdate < 1000)
+  {
+    return;
+  }
+  lastUpdate = now;
+  double phase = now / 600000.0 * 2 * M_PI;
+  setRegister(INPUT_REGISTER, 203, 2150 + (int16_t)(50 * sin(phase)));  // T3 exhaust
+  setRegister(INPUT_REGISTER, 204, 1200 + (int16_t)(300 * sin(phase))); // T4 outlet
+  setRegister(INPUT_REGISTER, 207, 1900 + (int16_t)(100 * sin(phase))); // T7 inlet
+  setRegister(INPUT_REGISTER, 208, 500 + (int16_t)(500 * sin(phase)));  // T8 outdoor
+  setRegister(INPUT_REGISTER, 221, 4500 + (int16_t)(800 * cos(phase))); // RH
+}
+
+void Cts602Simulator::receive(uint8_t c)
+{
+  // A new request starts over, like the silence between frames on a real line
+  if (responsePosition < responseLength)
+  {
+    responseLength = 0;
+    responsePosition = 0;
+  }
+  if (requestLength < sizeof(request))
+  {
+    request[requestLength++] = c;
+  }
+  uint16_t expected = 8;
+  if (requestLength >= 2 && request[1] == MODBUS_WRITE_MULTIPLE)
+  {
+    expected = requestLength >= 7 ? 9 + request[6] : 0xFFFF;
+  }
+  if (requestLength >= expected)
+  {
+    handle();
+    requestLength = 0;
+  }
+}
+
+void Cts602Simulator::exception(uint8_t code)
+{
+  simCounters.exceptions++;
+  response[1] |= 0x80;
+  response[2] = code;
+  respond(3);
+}
+
+void Cts602Simulator::handle()
+{
+  simCounters.requests++;
+  if (request[0] != slave || simCrc(request, requestLength - 2) != (request[requestLength - 2] | (request[requestLength - 1] << 8)))
+  {
+    return; // Not for us or garbled, a real slave stays silent too
+  }
+  if ((uint8_t)random(100) < faults.dropRate)
+  {
+    simCounters.dropped++;
+    return;
+  }
+  update();
+  uint8_t function = request[1];
+  uint16_t address = (request[2] << 8) | request[3];
+  uint16_t value = (request[4] << 8) | request[5]; // Count of a read or multiple write, value of a single write
+  response[0] = slave;
+  response[1] = function;
+  if ((uint8_t)random(100) < faults.exceptionRate)
+  {
+    exception(MODBUS_SLAVE_DEVICE_FAILURE);
+    return;
+  }
+  switch (function)
+  {
+  case MODBUS_READ_INPUT:
+  case MODBUS_READ_HOLDING:
+  {
+    uint8_t kind = function == MODBUS_READ_INPUT ? INPUT_REGISTER : HOLDING_REGISTER;
+    if (value == 0 || value > MODBUS_MAX_REGISTERS)
+    {
+      exception(MODBUS_ILLEGAL_DATA_VALUE);
+      return;
+    }
+    if (!valid(kind, address, value))
+    {
+      exception(MODBUS_ILLEGAL_DATA_ADDRESS);
+      return;
+    }
+    if (injected(kind, address, value))
+    {
+      exception(injected(kind, address, value));
+      return;
+    }
+    simCounters.reads++;
+    response[2] = value * 2;
+    for (uint16_t i = 0; i < value; i++)
+    {
+      int16_t v = getRegister(kind, address + i);
+      response[3 + 2 * i] = (uint16_t)v >> 8;
+      response[4 + 2 * i] = v & 0xFF;
+    }
+    respond(3 + value * 2);
+    break;
+  }
+  case MODBUS_WRITE_SINGLE:
+    if (!valid(HOLDING_REGISTER, address, 1))
+    {
+      exception(MODBUS_ILLEGAL_DATA_ADDRESS);
+      return;
+    }
+    if (injected(HOLDING_REGISTER, address, 1))
+    {
+      exception(injected(HOLDING_REGISTER, address, 1));
+      return;
+    }
+    simCounters.writes++;
+    setRegister(HOLDING_REGISTER, address, value);
+    memcpy(response + 2, request + 2, 4);
+    respond(6);
+    break;
+  case MODBUS_WRITE_MULTIPLE:
+    if (!valid(HOLDING_REGISTER, address, value))
+    {
+      exception(MODBUS_ILLEGAL_DATA_ADDRESS);
+      return;
+    }
+    if (injected(HOLDING_REGISTER, address, value))
+    {
+      exception(injected(HOLDING_REGISTER, address, value));
+      return;
+    }
+    simCounters.writes++;
+    for (uint16_t i = 0; i < value; i++)
+    {
+      setRegister(HOLDING_REGISTER, address + i, (request[7 + 2 * i] << 8) | request[8 + 2 * i]);
+    }
+    memcpy(response + 2, request + 2, 4);
+    respond(6);
+    break;
+  default:
+    exception(MODBUS_ILLEGAL_FUNCTION);
+  }
+}
+
+// Add the CRC and schedule the response
+void Cts602Simulator::respond(uint16_t length)
+{
+  uint16_t crc = simCrc(response, length);
+  response[length++] = crc & 0xFF;
+  response[length++] = crc >> 8;
+  if ((uint8_t)random(100) < faults.crcRate)
+  {
+    simCounters.corrupted++;
+    response[length - 1] ^= 0x5A;
+  }
+  responseLength = length;
+  responsePosition = 0;
+  unsigned long delay = faults.latency + (faults.jitter > 0 ? random(faults.jitter + 1) : 0);
+  responseReady = millis() + delay + (length * SIM_CHAR_MICROS) / 1000;
+}
+
+int Cts602Simulator::available()
+{
+  if (responsePosition >= responseLength || (long)(millis() - responseReady) < 0)
+  {
+    return 0;
+  }
+  return responseLength - responsePosition;
+}
+
+int Cts602Simulator::read()
+{
+  return available() > 0 ? response[responsePosition++] : -1;
+}
+
+#endif
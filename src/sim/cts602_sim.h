@@ -0,0 +1,65 @@
+/*
+ *  In-process CTS602 Modbus RTU slave for the native build.
+ *  Answers reads and writes of the register blocks of the controller: each hundred that holds a group of
+ *  register_map.def, from its start to the last register mapped in it. Other addresses get an illegal data
+ *  address exception like on the real controller. Responses arrive after the time the frame takes on
+ *  the wire at 19200 baud plus a configurable latency, and can be dropped or corrupted on purpose. Single
+ *  registers can be made to answer with an exception, e.g. to test how the gateway gets around them.
+ */
+#pragma once
+#ifdef NILAN_NATIVE
+#include <Arduino.h>
+
+struct SimFaults
+{
+  unsigned long latency; // Milliseconds before the controller starts to answer
+  unsigned long jitter;  // Up to this many milliseconds more, random
+  uint8_t dropRate;      // Percent of requests left unanswered
+  uint8_t crcRate;       // Percent of responses with a broken CRC
+  uint8_t exceptionRate; // Percent of requests answered with a slave device failure
+};
+
+struct SimCounters
+{
+  unsigned long requests;
+  unsigned long reads;
+  unsigned long writes;
+  unsigned long exceptions;
+  unsigned long dropped;
+  unsigned long corrupted;
+};
+
+class Cts602Simulator : public SerialPeer
+{
+public:
+  void begin(uint8_t slave, const SimFaults &faults);
+  void receive(uint8_t c) override;
+  int available() override;
+  int read() override;
+
+  int16_t getRegister(uint8_t kind, uint16_t address); // RegisterKind
+  void setRegister(uint8_t kind, uint16_t address, int16_t value);
+  void setException(uint8_t kind, uint16_t address, uint8_t code); // For every request touching the register, 0 clears it
+  const SimCounters &counters() const { return simCounters; }
+
+private:
+  void handle();
+  void respond(uint16_t length);
+  void exception(uint8_t code);
+  void update();
+  bool valid(uint8_t kind, uint16_t address, uint16_t count);
+  uint8_t injected(uint8_t kind, uint16_t address, uint16_t count); // Exception set for one of the registers, or 0
+
+  uint8_t slave = 0;
+  SimFaults faults = {};
+  SimCounters simCounters = {};
+  uint8_t request[9 + 2 * 125];
+  uint16_t requestLength = 0;
+  uint8_t response[5 + 2 * 125];
+  uint16_t responseLength = 0;
+  uint16_t responsePosition = 0;
+  unsigned long responseReady = 0; // millis() when the response has fully arrived
+  unsigned long lastUpdate = 0;
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ *  Entry point of the native build. Runs the gateway against the simulated CTS602 on the host.
+ *
+ *  Environment:
+ *    SIM_LATENCY, SIM_JITTER           milliseconds before the controller answers, and random extra
+ *    SIM_DROP, SIM_CRC, SIM_EXCEPTION  percent of requests unanswered, with broken CRC, answered with an exception
+ *    SIM_SEED                          random seed, for repeatable runs
+ *    NATIVE_SECONDS                    stop after this many seconds and print a summary, 0 runs forever
+ *    NATIVE_FS                         directory used as flash file system, default ./native_fs
+ *
+ *  MQTT goes to a broker on 127.0.0.1:1883, HTTP is served on port 8080.
+ *  Left out of `pio test`, the test runner brings its own main().
+ */
+#if defined(NILAN_NATIVE) && !defined(PIO_UNIT_TESTING)
+#include <Arduino.h>
+#include <unistd.h>
+#include "cts602_sim.h"
+#include "../configuration.h"
+#include "../modbus_engine.h"
+#include "../profiler.h"
+
+void setup();
+void loop();
+
+static Cts602Simulator simulator;
+
+static unsigned long envNumber(const char *name, unsigned long fallback)
+{
+  const char *value = getenv(name);
+  return value != NULL ? strtoul(value, NULL, 10) : fallback;
+}
+
+static void printSummary()
+{
+  const ModbusStats &stats = modbusStats();
+  const SimCounters &sim = simulator.counters();
+  const PhaseStats &loopStats = profileStats(PHASE_LOOP);
+  printf("{\"seconds\":%lu,\"modbus\":{", millis() / 1000);
+  for (uint8_t f = 0; f < MODBUS_STAT_FUNCTIONS; f++)
+  {
+    const ModbusFunctionStats &function = stats.function[f];
+    printf("\"%s\":{\"success\":%u,\"timeout\":%u,\"crc\":%u,\"exception\":%u,\"invalid\":%u},", modbusFunctionName(f),
+           function.success, function.timeout, function.crc,
+           function.exception[0] + function.exception[1] + function.exception[2] + function.exception[3], function.invalid);
+  }
+  printf("\"bytesSent\":%u,\"bytesReceived\":%u},", stats.bytesSent, stats.bytesReceived);
+  printf("\"simulator\":{\"requests\":%lu,\"reads\":%lu,\"writes\":%lu,\"exceptions\":%lu,\"dropped\":%lu,\"corrupted\":%lu},",
+         sim.requests, sim.reads, sim.writes, sim.exceptions, sim.dropped, sim.corrupted);
+  printf("\"loop\":{\"count\":%u,\"meanMicros\":%lu,\"maxMicros\":%u}}\n", loopStats.count,
+         loopStats.count ? (unsigned long)(loopStats.sum / loopStats.count) : 0UL, loopStats.max);
+}
+
+int main()
+{
+  SimFaults faults;
+  faults.latency = envNumber("SIM_LATENCY", 20);
+  faults.jitter = envNumber("SIM_JITTER", 10);
+  faults.dropRate = envNumber("SIM_DROP", 0);
+  faults.crcRate = envNumber("SIM_CRC", 0);
+  faults.exceptionRate = envNumber("SIM_EXCEPTION", 0);
+  randomSeed(envNumber("SIM_SEED", 1));
+  unsigned long seconds = envNumber("NATIVE_SECONDS", 0);
+
+  simulator.begin(MODBUS_SLAVE_ADDRESS, faults);
+  Serial.attach(&simulator);
+  setup();
+  while (seconds == 0 || millis() < seconds * 1000)
+  {
+    loop();
+    usleep(200);
+  }
+  printSummary();
+  return 0;
+}
+
+#endif
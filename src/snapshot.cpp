@@ -0,0 +1,66 @@
+#include "snapshot.h"
+#include "register_map.h"
+#include "timebase.h"
+
+static int16_t snapshotBuffer[groupRegisterTotal];
+static uint16_t snapshotOffset[reqmax]; // Position of each group in snapshotBuffer
+static uint32_t snapshotSequences[reqmax];
+static uint64_t snapshotTimes[reqmax];
+static bool snapshotReady = false;
+
+// Groups are stored back to back in ReqTypes order
+static void snapshotLayout()
+{
+  uint16_t offset = 0;
+  for (int g = 0; g < reqmax; g++)
+  {
+    snapshotOffset[g] = offset;
+    offset += getGroup(g).count;
+  }
+  snapshotReady = true;
+}
+
+void snapshotStore(int group, const int16_t *values)
+{
+  if (!snapshotReady)
+  {
+    snapshotLayout();
+  }
+  memcpy(snapshotBuffer + snapshotOffset[group], values, getGroup(group).count * sizeof(int16_t));
+  snapshotSequences[group]++;
+  snapshotTimes[group] = clockMillis();
+}
+
+void snapshotUpdate(int group, uint8_t offset, int16_t value)
+{
+  if (!snapshotValid(group))
+  {
+    return;
+  }
+  snapshotBuffer[snapshotOffset[group] + offset] = value;
+  snapshotSequences[group]++; // The time stays, it tells how old the rest of the group is
+}
+
+bool snapshotValid(int group)
+{
+  return snapshotSequences[group] != 0;
+}
+
+const int16_t *snapshotValues(int group)
+{
+  if (!snapshotReady)
+  {
+    snapshotLayout();
+  }
+  return snapshotBuffer + snapshotOffset[group];
+}
+
+uint32_t snapshotSequence(int group)
+{
+  return snapshotSequences[group];
+}
+
+uint64_t snapshotTime(int group)
+{
+  return snapshotTimes[group];
+}
@@ -0,0 +1,14 @@
+/*
+ *  Register snapshot cache.
+ *  Holds the last values read of every group, whoever read them. Each group carries a sequence number that
+ *  counts its updates and the clockMillis() of the last update, so HTTP and MQTT can be served without a bus read.
+ */
+#pragma once
+#include <Arduino.h>
+
+void snapshotStore(int group, const int16_t *values); // group.count values as read from the bus
+void snapshotUpdate(int group, uint8_t offset, int16_t value); // One register read on its own, ignored until the group is valid
+bool snapshotValid(int group);                         // False until the group has been read once
+const int16_t *snapshotValues(int group);
+uint32_t snapshotSequence(int group);
+uint64_t snapshotTime(int group); // clockMillis() of the last update
@@ -0,0 +1,114 @@
+#include "timebase.h"
+
+struct Timer
+{
+  TimerCallback callback;
+  unsigned long period; // 0 for a one-shot
+  uint64_t due;         // clockMillis() of the next run
+  bool armed;
+};
+
+static Timer timers[TIMER_MAX];
+static int8_t timerCount = 0;
+static uint64_t timerEarliest = 0; // No job is due before this
+
+uint64_t clockMillis()
+{
+  static uint32_t last = 0;
+  static uint32_t wraps = 0;
+  uint32_t now = millis();
+  if (now < last)
+  {
+    wraps++;
+  }
+  last = now;
+  return (uint64_t)wraps << 32 | now;
+}
+
+uint32_t clockSeconds()
+{
+  return clockMillis() / 1000;
+}
+
+int8_t timerAdd(TimerCallback callback, unsigned long period, unsigned long first)
+{
+  if (timerCount >= TIMER_MAX)
+  {
+    return -1;
+  }
+  int8_t id = timerCount++;
+  timers[id].callback = callback;
+  timers[id].period = period;
+  timers[id].armed = false;
+  if (period != 0)
+  {
+    timerStart(id, first);
+  }
+  return id;
+}
+
+void timerStart(int8_t id, unsigned long delay)
+{
+  if (id < 0 || id >= timerCount)
+  {
+    return;
+  }
+  timers[id].due = clockMillis() + delay;
+  timers[id].armed = true;
+  if (timers[id].due < timerEarliest)
+  {
+    timerEarliest = timers[id].due;
+  }
+}
+
+void timerTrigger(int8_t id)
+{
+  timerStart(id, 0);
+}
+
+void timerStop(int8_t id)
+{
+  if (id >= 0 && id < timerCount)
+  {
+    timers[id].armed = false;
+  }
+}
+
+void timerLoop()
+{
+  uint64_t now = clockMillis();
+  if (now < timerEarliest)
+  {
+    return;
+  }
+  for (int8_t i = 0; i < timerCount; i++)
+  {
+    Timer &timer = timers[i];
+    if (!timer.armed || now < timer.due)
+    {
+      continue;
+    }
+    if (timer.period == 0)
+    {
+      timer.armed = false;
+    }
+    else
+    {
+      // Keep the phase, unless the job is late by a whole period
+      timer.due += timer.period;
+      if (timer.due <= now)
+      {
+        timer.due = now + timer.period;
+      }
+    }
+    timer.callback(); // Free to arm or stop any job, itself included
+  }
+  timerEarliest = UINT64_MAX;
+  for (int8_t i = 0; i < timerCount; i++)
+  {
+    if (timers[i].armed && timers[i].due < timerEarliest)
+    {
+      timerEarliest = timers[i].due;
+    }
+  }
+}
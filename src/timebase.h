@@ -0,0 +1,24 @@
+/*
+ *  Timebase and periodic jobs.
+ *  clockMillis() is millis() carried into 64 bits, so it never wraps and the gateway can run for years
+ *  without a reboot. Periodic work registers a job once instead of keeping its own millis() comparison in
+ *  loop(): timerLoop() runs every job that is due. Jobs with period 0 are one-shots that are armed with
+ *  timerStart(), e.g. a retry after a backoff. A handful of jobs is expected, so they are kept in a small table.
+ */
+#pragma once
+#include <Arduino.h>
+
+#define TIMER_MAX 12 // Jobs that can be registered
+
+typedef void (*TimerCallback)();
+
+uint64_t clockMillis();  // Milliseconds since boot. timerLoop() calls it often enough to catch every wrap of millis()
+uint32_t clockSeconds(); // Seconds since boot
+
+// Registers a job, run every period milliseconds with the first run after first. Period 0 is a one-shot that
+// only runs when armed with timerStart(). Returns the id of the job, -1 when TIMER_MAX are registered
+int8_t timerAdd(TimerCallback callback, unsigned long period, unsigned long first = 0);
+void timerStart(int8_t id, unsigned long delay); // (Re)arms the job to run after delay milliseconds
+void timerTrigger(int8_t id);                     // Runs the job at the next timerLoop()
+void timerStop(int8_t id);                        // Until the next timerStart()
+void timerLoop();                                 // Runs the jobs that are due, from loop()
@@ -0,0 +1,87 @@
+#include "value_format.h"
+#include "alarm_decoder.h"
+
+// Text of a register holding 2 ASCII characters
+void decodeAscii(int16_t value, char *text)
+{
+  text[0] = (char)(value >> 8);
+  text[1] = (char)(value & 0x00ff);
+  text[2] = 0;
+  // Remove the padding space of one character strings
+  if (text[1] == ' ')
+  {
+    text[1] = 0;
+  }
+  if (text[0] == ' ')
+  {
+    memmove(text, text + 1, 2);
+  }
+}
+
+// Named registers of a group as JSON members
+void addRegisterValues(JsonObject root, int r, const int16_t *values)
+{
+  GroupDesc group = getGroup(r);
+  for (int i = 0; i < group.registerCount; i++)
+  {
+    RegisterDesc reg = getRegister(group.firstRegister + i);
+    const __FlashStringHelper *name = FPSTR(reg.name);
+    int16_t value = values[reg.offset];
+    switch (reg.format)
+    {
+    case FORMAT_ASCII:
+    {
+      char text[3];
+      decodeAscii(value, text);
+      root[name] = text;
+      break;
+    }
+    case FORMAT_TEMP:
+    case FORMAT_HUMIDITY:
+    case FORMAT_SCALED:
+      root[name] = value / 100.0;
+      break;
+    default:
+      root[name] = value;
+    }
+  }
+}
+
+// Text for a register value as published on MQTT
+void formatValue(const RegisterDesc &reg, int16_t value, char *numberString)
+{
+  switch (reg.format)
+  {
+  case FORMAT_TEMP:
+  case FORMAT_HUMIDITY:
+  case FORMAT_SCALED:
+    dtostrf((value / 100.0), 5, 2, numberString);
+    break;
+  case FORMAT_ASCII:
+    decodeAscii(value, numberString);
+    break;
+  case FORMAT_ALARM_CODE:
+    formatAlarmCode(value, numberString);
+    break;
+  case FORMAT_DOS_DATE:
+    formatDosDate(value, numberString);
+    break;
+  case FORMAT_DOS_TIME:
+    formatDosTime(value, numberString);
+    break;
+  default:
+    itoa(value, numberString, 10);
+  }
+}
+
+char mqttTopic[64] = TOPIC_PREFIX;
+
+const char *registerTopic(uint8_t topic, const RegisterDesc &reg)
+{
+  char *tail = mqttTopic + TOPIC_PREFIX_LENGTH;
+  strcpy_P(tail, getTopicName(topic));
+  tail += strlen(tail);
+  *tail++ = '/';
+  strcpy_P(tail, reg.name);
+  return mqttTopic;
+}
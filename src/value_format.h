@@ -0,0 +1,21 @@
+/*
+ *  Register values as text and JSON, and the MQTT topics they are published to.
+ *  Shared by the poller, the HTTP API and the benchmarks.
+ */
+#pragma once
+#include <ArduinoJson.h>
+#include "register_map.h"
+
+// Room for the largest response, a read of the biggest group or the help page. Keys and texts are copied into the document
+const int responseMembers = (int)reqmax > MAX_REG_SIZE ? (int)reqmax : MAX_REG_SIZE;
+const size_t responseCapacity = JSON_OBJECT_SIZE(responseMembers + 8) + responseMembers * 48 + 128;
+
+// Topic buffer with the common prefix already in place, only the tail is written per publish
+#define TOPIC_PREFIX "ventilation/"
+#define TOPIC_PREFIX_LENGTH (sizeof(TOPIC_PREFIX) - 1)
+extern char mqttTopic[64];
+
+void decodeAscii(int16_t value, char *text);                               // text holds 3 characters
+void formatValue(const RegisterDesc &reg, int16_t value, char *numberString); // numberString holds 12 characters
+const char *registerTopic(uint8_t topic, const RegisterDesc &reg);          // Written to mqttTopic
+void addRegisterValues(JsonObject root, int r, const int16_t *values);      // Named registers of group r
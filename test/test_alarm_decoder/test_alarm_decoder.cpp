@@ -0,0 +1,143 @@
+/*
+ *  Alarm list decoding: DOS date and time bitfields, the code table and the ring buffer of seen alarms.
+ *  pio test -e native -f test_alarm_decoder
+ */
+#include <unity.h>
+#include "alarm_decoder.h"
+
+// 2023-03-15 14:37:58 as the CTS602 packs it
+#define DATE_2023_03_15 ((43 << 9) | (3 << 5) | 15)
+#define TIME_14_37_58 ((14 << 11) | (37 << 5) | 29)
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_decode_date()
+{
+  DosDate date = decodeDosDate(DATE_2023_03_15);
+  TEST_ASSERT_EQUAL_UINT16(2023, date.year);
+  TEST_ASSERT_EQUAL_UINT8(3, date.month);
+  TEST_ASSERT_EQUAL_UINT8(15, date.day);
+  date = decodeDosDate((0 << 9) | (1 << 5) | 1);
+  TEST_ASSERT_EQUAL_UINT16(1980, date.year);
+  date = decodeDosDate(0xFFFF);
+  TEST_ASSERT_EQUAL_UINT16(1980 + 127, date.year);
+  TEST_ASSERT_EQUAL_UINT8(15, date.month);
+  TEST_ASSERT_EQUAL_UINT8(31, date.day);
+}
+
+static void test_decode_time()
+{
+  DosTime time = decodeDosTime(TIME_14_37_58);
+  TEST_ASSERT_EQUAL_UINT8(14, time.hour);
+  TEST_ASSERT_EQUAL_UINT8(37, time.minute);
+  TEST_ASSERT_EQUAL_UINT8(58, time.second);
+}
+
+// The seconds field counts 2 second steps
+static void test_decode_time_seconds()
+{
+  TEST_ASSERT_EQUAL_UINT8(0, decodeDosTime(0).second);
+  TEST_ASSERT_EQUAL_UINT8(2, decodeDosTime(1).second);
+  TEST_ASSERT_EQUAL_UINT8(30, decodeDosTime(15).second);
+  TEST_ASSERT_EQUAL_UINT8(0, decodeDosTime(1 << 5).second);
+  TEST_ASSERT_EQUAL_UINT8(1, decodeDosTime(1 << 5).minute);
+}
+
+static void test_format_date_time()
+{
+  char text[12];
+  formatDosDate(DATE_2023_03_15, text);
+  TEST_ASSERT_EQUAL_STRING("2023-03-15", text);
+  formatDosTime(TIME_14_37_58, text);
+  TEST_ASSERT_EQUAL_STRING("14:37:58", text);
+  formatDosDate(0, text);
+  TEST_ASSERT_EQUAL_STRING("N/A", text);
+  formatDosTime(0, text);
+  TEST_ASSERT_EQUAL_STRING("N/A", text);
+}
+
+static void test_alarm_codes()
+{
+  char text[12];
+  formatAlarmCode(0, text);
+  TEST_ASSERT_EQUAL_STRING("None", text);
+  formatAlarmCode(6, text);
+  TEST_ASSERT_EQUAL_STRING("DEFROST", text);
+  formatAlarmCode(92, text);
+  TEST_ASSERT_EQUAL_STRING("PRESET", text);
+  TEST_ASSERT_NOT_NULL(alarmText(19));
+}
+
+// Codes in the gaps of the table and beyond its end
+static void test_unknown_alarm_codes()
+{
+  char text[12];
+  TEST_ASSERT_NULL(alarmText(59));
+  TEST_ASSERT_NULL(alarmText(93));
+  TEST_ASSERT_NULL(alarmText(0xFFFF));
+  formatAlarmCode(60, text);
+  TEST_ASSERT_EQUAL_STRING("UNKNOWN", text);
+  formatAlarmCode(500, text);
+  TEST_ASSERT_EQUAL_STRING("UNKNOWN", text);
+}
+
+// Runs first, the ring buffer is empty
+static void test_update_reports_once()
+{
+  int16_t list[ALARM_SLOTS * 3] = {5, DATE_2023_03_15, TIME_14_37_58, 0, 0, 0, 0, 0, 0};
+  AlarmEvent events[ALARM_SLOTS];
+  TEST_ASSERT_EQUAL_UINT8(1, alarmUpdate(list, events));
+  TEST_ASSERT_EQUAL_UINT16(5, events[0].code);
+  TEST_ASSERT_EQUAL_UINT16(DATE_2023_03_15, events[0].date);
+  TEST_ASSERT_EQUAL_UINT16(TIME_14_37_58, events[0].time);
+  TEST_ASSERT_EQUAL_UINT8(0, alarmUpdate(list, events));
+  TEST_ASSERT_EQUAL_UINT8(1, alarmHistoryCount());
+
+  // Same code at another time is a new alarm, the known one moves down the list and stays known
+  list[3] = list[0];
+  list[4] = list[1];
+  list[5] = list[2];
+  list[2] = TIME_14_37_58 + 1;
+  TEST_ASSERT_EQUAL_UINT8(1, alarmUpdate(list, events));
+  TEST_ASSERT_EQUAL_UINT16(TIME_14_37_58 + 1, events[0].time);
+  TEST_ASSERT_EQUAL_UINT8(2, alarmHistoryCount());
+  TEST_ASSERT_EQUAL_UINT16(TIME_14_37_58 + 1, alarmHistory(0).time);
+  TEST_ASSERT_EQUAL_UINT16(TIME_14_37_58, alarmHistory(1).time);
+}
+
+static void test_update_ring_buffer_wraps()
+{
+  AlarmEvent events[ALARM_SLOTS];
+  for (int i = 0; i < ALARM_HISTORY_SIZE + 2; i++)
+  {
+    int16_t list[ALARM_SLOTS * 3] = {(int16_t)(10 + i), DATE_2023_03_15, 0, 0, 0, 0, 0, 0, 0};
+    TEST_ASSERT_EQUAL_UINT8(1, alarmUpdate(list, events));
+  }
+  TEST_ASSERT_EQUAL_UINT8(ALARM_HISTORY_SIZE, alarmHistoryCount());
+  TEST_ASSERT_EQUAL_UINT16(10 + ALARM_HISTORY_SIZE + 1, alarmHistory(0).code);
+  TEST_ASSERT_EQUAL_UINT16(12, alarmHistory(ALARM_HISTORY_SIZE - 1).code);
+
+  // The whole list of the controller always fits, so its entries are not reported again
+  int16_t list[ALARM_SLOTS * 3] = {17, DATE_2023_03_15, 0, 18, DATE_2023_03_15, 0, 19, DATE_2023_03_15, 0};
+  TEST_ASSERT_EQUAL_UINT8(0, alarmUpdate(list, events));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_decode_date);
+  RUN_TEST(test_decode_time);
+  RUN_TEST(test_decode_time_seconds);
+  RUN_TEST(test_format_date_time);
+  RUN_TEST(test_alarm_codes);
+  RUN_TEST(test_unknown_alarm_codes);
+  RUN_TEST(test_update_reports_once);
+  RUN_TEST(test_update_ring_buffer_wraps);
+  return UNITY_END();
+}
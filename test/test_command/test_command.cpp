@@ -0,0 +1,108 @@
+/*
+ *  Command round-trip against the simulated controller: a write queued as over MQTT reaches the register,
+ *  is read back and reported to the callback. Writes to a register that is still waiting are coalesced.
+ *  pio test -e native -f test_command
+ */
+#include <unity.h>
+#include "command_queue.h"
+#include "modbus_engine.h"
+#include "register_map.h"
+#include "sim/cts602_sim.h"
+
+#define COMMAND_TIMEOUT 5000 // Milliseconds
+
+static Cts602Simulator sim;
+static uint8_t reported;
+static uint16_t reportedAddress;
+static int16_t reportedValue;
+static uint8_t reportedResult;
+
+static void commandDone(uint16_t address, int16_t value, uint8_t result)
+{
+  reported++;
+  reportedAddress = address;
+  reportedValue = value;
+  reportedResult = result;
+}
+
+// Runs the queue and the engine until the callback was called count times. False on timeout
+static bool waitReports(uint8_t count)
+{
+  unsigned long start = millis();
+  while (millis() - start < COMMAND_TIMEOUT)
+  {
+    commandLoop();
+    modbusLoop();
+    if (reported >= count)
+    {
+      return true;
+    }
+    delay(1);
+  }
+  return false;
+}
+
+void setUp()
+{
+  SimFaults faults = {};
+  sim.begin(30, faults);
+  Serial.attach(&sim);
+  modbusBegin(Serial, 30);
+  commandBegin(commandDone);
+  reported = 0;
+}
+
+void tearDown()
+{
+}
+
+static void test_write_round_trip()
+{
+  TEST_ASSERT_TRUE(commandWrite(1003, 3));
+  TEST_ASSERT_TRUE(waitReports(1));
+  TEST_ASSERT_EQUAL_UINT8(MODBUS_SUCCESS, reportedResult);
+  TEST_ASSERT_EQUAL_UINT16(1003, reportedAddress);
+  TEST_ASSERT_EQUAL_INT16(3, reportedValue);
+  TEST_ASSERT_EQUAL_INT16(3, sim.getRegister(HOLDING_REGISTER, 1003));
+}
+
+static void test_writes_coalesce()
+{
+  unsigned long writes = sim.counters().writes;
+  TEST_ASSERT_TRUE(commandWrite(1004, 2000));
+  TEST_ASSERT_TRUE(commandWrite(1004, 2150));
+  TEST_ASSERT_TRUE(commandWrite(1004, 2300));
+  TEST_ASSERT_TRUE(waitReports(1));
+  TEST_ASSERT_EQUAL_INT16(2300, reportedValue);
+  TEST_ASSERT_EQUAL_INT16(2300, sim.getRegister(HOLDING_REGISTER, 1004));
+  TEST_ASSERT_EQUAL_UINT32(writes + 1, sim.counters().writes);
+}
+
+static void test_rejected_write_reports_exception()
+{
+  TEST_ASSERT_TRUE(commandWrite(9000, 1));
+  TEST_ASSERT_TRUE(waitReports(1));
+  TEST_ASSERT_EQUAL_UINT16(9000, reportedAddress);
+  TEST_ASSERT_EQUAL_UINT8(MODBUS_ILLEGAL_DATA_ADDRESS, reportedResult);
+}
+
+static void test_queue_full()
+{
+  for (uint16_t i = 0; i < COMMAND_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(commandWrite(1000 + i, 1));
+  }
+  TEST_ASSERT_FALSE(commandWrite(1000 + COMMAND_QUEUE_SIZE, 1));
+  TEST_ASSERT_TRUE(commandWrite(1000, 0)); // Already waiting, replaces the value
+  TEST_ASSERT_TRUE(waitReports(COMMAND_QUEUE_SIZE));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_write_round_trip);
+  RUN_TEST(test_writes_coalesce);
+  RUN_TEST(test_rejected_write_reports_exception);
+  RUN_TEST(test_queue_full);
+  return UNITY_END();
+}
@@ -0,0 +1,278 @@
+/*
+ *  One poll cycle against the simulated controller: the planner merges groups into reads, the Modbus engine
+ *  runs them over the simulated bus and every group comes back with the values the controller holds. The
+ *  poll cycle fans merged reads out to the snapshot cache and falls back to single groups when a merge fails.
+ *  pio test -e native -f test_poll_cycle
+ */
+#include <unity.h>
+#include "configuration.h"
+#include "register_map.h"
+#include "read_planner.h"
+#include "modbus_engine.h"
+#include "poll_cycle.h"
+#include "snapshot.h"
+#include "sim/cts602_sim.h"
+
+#define POLL_TIMEOUT 10000 // Milliseconds for a whole cycle
+
+static Cts602Simulator sim;
+
+struct SpanRead
+{
+  ReadSpan span;
+  int16_t values[MODBUS_MAX_REGISTERS];
+  uint8_t result;
+  bool done;
+};
+
+static void readDone(ModbusTransaction &transaction)
+{
+  SpanRead *read = (SpanRead *)transaction.context;
+  read->result = transaction.result;
+  read->done = true;
+}
+
+// Reads every span and waits for all of them. False when the engine did not finish in time
+static bool runReads(SpanRead *reads, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    reads[i].done = false;
+  }
+  uint8_t submitted = 0;
+  unsigned long start = millis();
+  while (millis() - start < POLL_TIMEOUT)
+  {
+    // The engine queue holds fewer transactions than a full cycle has reads, like the poller they are handed over as room frees up
+    while (submitted < count && modbusRead(reads[submitted].span.address, reads[submitted].span.count, reads[submitted].values, reads[submitted].span.type, readDone, &reads[submitted]))
+    {
+      submitted++;
+    }
+    modbusLoop();
+    bool all = true;
+    for (uint8_t i = 0; i < count; i++)
+    {
+      all = all && reads[i].done;
+    }
+    if (all)
+    {
+      return true;
+    }
+    delay(1);
+  }
+  return false;
+}
+
+// Every named register of the groups in the span must hold what the simulator holds. Temperatures and
+// humidity drift a little every second while the cycle runs
+#define DRIFT 10
+static void checkGroup(int g, const int16_t *values)
+{
+  GroupDesc group = getGroup(g);
+  for (int i = 0; i < group.registerCount; i++)
+  {
+    RegisterDesc reg = getRegister(group.firstRegister + i);
+    TEST_ASSERT_INT16_WITHIN(DRIFT, sim.getRegister(group.kind, group.address + reg.offset), values[reg.offset]);
+  }
+}
+
+static void checkSpan(const SpanRead &read)
+{
+  for (int g = 0; g < reqmax; g++)
+  {
+    if (read.span.groups & (1UL << g))
+    {
+      checkGroup(g, read.values + (getGroup(g).address - read.span.address));
+    }
+  }
+}
+
+static uint32_t cycleRead;   // Groups handed to the read handler
+static uint32_t cycleFailed; // Groups handed to the error handler
+static bool cycleFinished;
+
+static void cycleReadHandler(int group, const int16_t *values)
+{
+  TEST_ASSERT_TRUE(snapshotValid(group));
+  TEST_ASSERT_EQUAL_INT(0, memcmp(values, snapshotValues(group), getGroup(group).count * sizeof(int16_t)));
+  cycleRead |= 1UL << group;
+}
+
+static void cycleErrorHandler(uint32_t groups)
+{
+  cycleFailed |= groups;
+}
+
+static void cycleFinishHandler()
+{
+  cycleFinished = true;
+}
+
+// Runs a poll cycle of the groups to its end. False when it did not finish in time
+static bool runCycle(uint32_t groups)
+{
+  cycleRead = 0;
+  cycleFailed = 0;
+  cycleFinished = false;
+  pollStart(groups);
+  unsigned long start = millis();
+  while (!cycleFinished && millis() - start < POLL_TIMEOUT)
+  {
+    modbusLoop();
+    delay(1);
+  }
+  return cycleFinished && !pollRunning();
+}
+
+void setUp()
+{
+  SimFaults faults = {};
+  sim.begin(30, faults);
+  Serial.attach(&sim);
+  modbusBegin(Serial, 30);
+  pollBegin(cycleReadHandler, cycleErrorHandler, cycleFinishHandler);
+}
+
+void tearDown()
+{
+}
+
+static void test_plan_merges_temperatures()
+{
+  ReadSpan spans[4];
+  uint32_t mask = (1UL << reqtemp1) | (1UL << reqtemp2) | (1UL << reqtemp3);
+  uint8_t count = planReads(mask, 0, MODBUS_PLAN_MAX_GAP, MODBUS_PLAN_MAX_FRAME, spans, 4);
+  TEST_ASSERT_EQUAL_UINT8(1, count);
+  TEST_ASSERT_EQUAL_UINT32(mask, spans[0].groups);
+  TEST_ASSERT_EQUAL_UINT16(getGroup(reqtemp1).address, spans[0].address);
+  TEST_ASSERT_EQUAL_UINT8(getGroup(reqtemp3).address + getGroup(reqtemp3).count - getGroup(reqtemp1).address, spans[0].count);
+}
+
+static void test_plan_without_merging()
+{
+  static ReadSpan spans[reqmax];
+  uint32_t mask = 0;
+  uint8_t groups = 0;
+  for (int g = 0; g < reqmax; g++)
+  {
+    if (getGroup(g).count > 0)
+    {
+      mask |= 1UL << g;
+      groups++;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT8(groups, planReads(mask, 0, -1, MODBUS_PLAN_MAX_FRAME, spans, reqmax));
+  for (uint8_t i = 0; i < groups; i++)
+  {
+    GroupDesc group = getGroup(__builtin_ctz(spans[i].groups));
+    TEST_ASSERT_EQUAL_UINT16(group.address, spans[i].address);
+    TEST_ASSERT_EQUAL_UINT8(group.count, spans[i].count);
+  }
+}
+
+static void test_merged_read_across_hole()
+{
+  static SpanRead read;
+  uint32_t mask = (1UL << reqtemp1) | (1UL << reqtemp2);
+  TEST_ASSERT_EQUAL_UINT8(1, planReads(mask, 0, MODBUS_PLAN_MAX_GAP, MODBUS_PLAN_MAX_FRAME, &read.span, 1));
+  TEST_ASSERT_TRUE(read.span.count > getGroup(reqtemp1).count + getGroup(reqtemp2).count);
+  uint16_t hole = getGroup(reqtemp1).address + getGroup(reqtemp1).count; // Not in any group
+  sim.setRegister(INPUT_REGISTER, hole, 1234);
+  TEST_ASSERT_TRUE(runReads(&read, 1));
+  TEST_ASSERT_EQUAL_UINT8(MODBUS_SUCCESS, read.result);
+  TEST_ASSERT_EQUAL_INT16(1234, read.values[hole - read.span.address]);
+  checkSpan(read);
+}
+
+static void test_poll_cycle_all_groups()
+{
+  static SpanRead reads[reqmax];
+  static ReadSpan spans[reqmax];
+  uint32_t mask = 0;
+  for (int g = 0; g < reqmax; g++)
+  {
+    if (getGroup(g).count > 0)
+    {
+      mask |= 1UL << g;
+    }
+  }
+  uint8_t count = planReads(mask, 0, MODBUS_PLAN_MAX_GAP, MODBUS_PLAN_MAX_FRAME, spans, reqmax);
+  TEST_ASSERT_TRUE(count > 0);
+  uint32_t covered = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    reads[i].span = spans[i];
+    covered |= spans[i].groups;
+  }
+  TEST_ASSERT_EQUAL_UINT32(mask, covered);
+  unsigned long exceptions = sim.counters().exceptions;
+  TEST_ASSERT_TRUE(runReads(reads, count));
+  for (uint8_t i = 0; i < count; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT8(MODBUS_SUCCESS, reads[i].result);
+    checkSpan(reads[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(exceptions, sim.counters().exceptions);
+}
+
+static void test_unknown_register_is_exception()
+{
+  static SpanRead read;
+  read.span.type = INPUT_REGISTER;
+  read.span.address = 9000;
+  read.span.count = 1;
+  read.span.groups = 0;
+  TEST_ASSERT_TRUE(runReads(&read, 1));
+  TEST_ASSERT_EQUAL_UINT8(MODBUS_ILLEGAL_DATA_ADDRESS, read.result);
+}
+
+static void test_cycle_fans_out_merged_read()
+{
+  uint32_t mask = (1UL << reqtemp1) | (1UL << reqtemp2) | (1UL << reqtemp3);
+  unsigned long reads = sim.counters().reads;
+  TEST_ASSERT_TRUE(runCycle(mask));
+  TEST_ASSERT_EQUAL_UINT32(reads + 1, sim.counters().reads);
+  TEST_ASSERT_EQUAL_UINT32(mask, cycleRead);
+  TEST_ASSERT_EQUAL_UINT32(0, cycleFailed);
+  for (int g = reqtemp1; g <= reqtemp3; g++)
+  {
+    checkGroup(g, snapshotValues(g));
+  }
+}
+
+static void test_cycle_falls_back_to_single_groups()
+{
+  uint32_t mask = (1UL << reqtemp1) | (1UL << reqtemp2) | (1UL << reqtemp3);
+  // The register between temp1 and temp2 is missing, the merged read is rejected
+  sim.setException(INPUT_REGISTER, getGroup(reqtemp1).address + getGroup(reqtemp1).count, MODBUS_ILLEGAL_DATA_ADDRESS);
+  sim.setRegister(INPUT_REGISTER, getGroup(reqtemp3).address, 1234);
+  unsigned long exceptions = sim.counters().exceptions;
+  TEST_ASSERT_TRUE(runCycle(mask));
+  TEST_ASSERT_EQUAL_UINT32(exceptions + 1, sim.counters().exceptions);
+  TEST_ASSERT_EQUAL_UINT32(mask, cycleRead);
+  TEST_ASSERT_EQUAL_UINT32(0, cycleFailed);
+  TEST_ASSERT_EQUAL_UINT32(mask, pollStandalone() & mask);
+  for (int g = reqtemp1; g <= reqtemp3; g++)
+  {
+    checkGroup(g, snapshotValues(g));
+  }
+  // The next cycle reads them one by one right away
+  unsigned long reads = sim.counters().reads;
+  TEST_ASSERT_TRUE(runCycle(mask));
+  TEST_ASSERT_EQUAL_UINT32(exceptions + 1, sim.counters().exceptions);
+  TEST_ASSERT_EQUAL_UINT32(reads + 3, sim.counters().reads);
+  TEST_ASSERT_EQUAL_UINT32(mask, cycleRead);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_plan_merges_temperatures);
+  RUN_TEST(test_plan_without_merging);
+  RUN_TEST(test_merged_read_across_hole);
+  RUN_TEST(test_poll_cycle_all_groups);
+  RUN_TEST(test_unknown_register_is_exception);
+  RUN_TEST(test_cycle_fans_out_merged_read);
+  RUN_TEST(test_cycle_falls_back_to_single_groups);
+  return UNITY_END();
+}